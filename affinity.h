@@ -0,0 +1,182 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* CPU affinity of the simulation threads, and their scheduler statistics from /proc */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static pid_t current_thread_id(void)
+{
+  return (pid_t) syscall(SYS_gettid);
+}
+
+/* parses a Linux CPU list such as "0-3,8,10-11"; returns false if it is malformed or empty */
+static bool cpu_list_parse(const char *cpu_list_str, std::vector<int> &cpus)
+{
+  const char *curr = cpu_list_str;
+  while (*curr != '\0' && *curr != '\n') {
+    char *end;
+    long first_cpu = strtol(curr, &end, 10);
+    if (end == curr || first_cpu < 0) return false;
+    long last_cpu = first_cpu;
+    if (*end == '-') {
+      curr = end + 1;
+      last_cpu = strtol(curr, &end, 10);
+      if (end == curr || last_cpu < first_cpu) return false;
+    }
+    for (long cpu = first_cpu; cpu <= last_cpu; cpu++)
+      cpus.push_back(cpu);
+    curr = *end == ',' ? end + 1 : end;
+  }
+  return !cpus.empty();
+}
+
+/* CPUs of a NUMA node, as listed by sysfs */
+static bool numa_node_cpus(int node, std::vector<int> &cpus)
+{
+  std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+  FILE *f = fopen(path.c_str(), "r");
+  char cpu_list_str[4096];
+  bool read_ok = f != NULL && fgets(cpu_list_str, sizeof(cpu_list_str), f) != NULL;
+  if (f != NULL) fclose(f);
+  if (!read_ok || !cpu_list_parse(cpu_list_str, cpus)) {
+    std::cerr << "Could not read the CPUs of NUMA node " << node << "." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/* restricts a thread of this process to a set of CPUs */
+static bool pin_thread(pid_t tid, const int *cpus, size_t num_cpus)
+{
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (size_t i = 0; i < num_cpus; i++)
+    CPU_SET(cpus[i], &cpu_set);
+  if (sched_setaffinity(tid, sizeof(cpu_set), &cpu_set)) {
+    std::cerr << "Could not set the affinity of thread " << tid << "." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/* ids of all the threads of this process */
+static std::vector<pid_t> process_thread_ids(void)
+{
+  std::vector<pid_t> tids;
+  DIR *dirp = opendir("/proc/self/task");
+  if (dirp == NULL)
+    return tids;
+  while (struct dirent *entry = readdir(dirp)) {
+    if (entry->d_name[0] != '.')
+      tids.push_back(atoi(entry->d_name));
+  }
+  closedir(dirp);
+  std::sort(tids.begin(), tids.end());
+  return tids;
+}
+
+/*
+ * Returns the calling thread followed by the threads that appeared since tids_before, which are those
+ * of a model constructed in between. With cpus, pins the i-th of these threads to cpus[i % cpus.size()].
+ */
+static std::vector<pid_t> model_threads_pin(const std::vector<pid_t> &tids_before, const std::vector<int> &cpus)
+{
+  std::vector<pid_t> model_tids(1, current_thread_id());
+  for (pid_t tid : process_thread_ids()) {
+    if (tid != model_tids[0] && !std::binary_search(tids_before.begin(), tids_before.end(), tid))
+      model_tids.push_back(tid);
+  }
+  for (size_t i = 0; i < model_tids.size() && !cpus.empty(); i++) {
+    if (!pin_thread(model_tids[i], &cpus[i % cpus.size()], 1))
+      exit(1);
+  }
+  return model_tids;
+}
+
+struct ThreadCpuTime {
+  pid_t tid;
+  // Time spent running, and waiting on a run queue.
+  uint64_t cpu_ns;
+  uint64_t wait_ns;
+  // CPU the thread last ran on.
+  int last_cpu;
+};
+
+/* reads the scheduler statistics of a thread, from schedstat when available and from stat otherwise */
+static ThreadCpuTime thread_cpu_time(pid_t tid)
+{
+  ThreadCpuTime time = {tid, 0, 0, -1};
+  std::string task_dir = "/proc/self/task/" + std::to_string(tid);
+  unsigned long long cpu_ns, wait_ns;
+  FILE *f = fopen((task_dir + "/schedstat").c_str(), "r");
+  bool has_schedstat = f != NULL && fscanf(f, "%llu %llu", &cpu_ns, &wait_ns) == 2;
+  if (f != NULL) fclose(f);
+  if (has_schedstat) {
+    time.cpu_ns = cpu_ns;
+    time.wait_ns = wait_ns;
+  }
+
+  // The fields of stat after the command name, which may contain spaces, are utime (14), stime (15) and processor (39).
+  char stat_line[1024];
+  f = fopen((task_dir + "/stat").c_str(), "r");
+  bool has_stat = f != NULL && fgets(stat_line, sizeof(stat_line), f) != NULL;
+  if (f != NULL) fclose(f);
+  const char *fields = has_stat ? strrchr(stat_line, ')') : NULL;
+  if (fields == NULL)
+    return time;
+  unsigned long long utime, stime;
+  int last_cpu;
+  if (sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %*u %*u %*d %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
+             &utime, &stime, &last_cpu) != 3)
+    return time;
+  time.last_cpu = last_cpu;
+  if (!has_schedstat)
+    time.cpu_ns = (utime + stime) * (1000000000ull / sysconf(_SC_CLK_TCK));
+  return time;
+}
+
+static std::vector<ThreadCpuTime> thread_cpu_times(const std::vector<pid_t> &tids)
+{
+  std::vector<ThreadCpuTime> times;
+  for (pid_t tid : tids)
+    times.push_back(thread_cpu_time(tid));
+  return times;
+}
+
+/* turns end times into the time spent by each thread since the start times */
+static void thread_cpu_times_diff(std::vector<ThreadCpuTime> &times, const std::vector<ThreadCpuTime> &start_times)
+{
+  for (size_t i = 0; i < times.size(); i++) {
+    times[i].cpu_ns -= std::min(times[i].cpu_ns, start_times[i].cpu_ns);
+    times[i].wait_ns -= std::min(times[i].wait_ns, start_times[i].wait_ns);
+  }
+}
+
+/* prints the time of each thread, and the imbalance as the maximal over the mean CPU time */
+static void thread_cpu_times_print(std::ostream &out, const std::vector<ThreadCpuTime> &times)
+{
+  uint64_t total_cpu_ns = 0, max_cpu_ns = 0;
+  for (const ThreadCpuTime &time : times) {
+    out << "Thread " << std::dec << time.tid << " (CPU " << time.last_cpu << "): " << time.cpu_ns / 1000000.0
+        << " ms running, " << time.wait_ns / 1000000.0 << " ms waiting." << std::endl;
+    total_cpu_ns += time.cpu_ns;
+    max_cpu_ns = std::max(max_cpu_ns, time.cpu_ns);
+  }
+  if (total_cpu_ns > 0)
+    out << "Thread imbalance: " << (double) max_cpu_ns * times.size() / total_cpu_ns << "." << std::endl;
+}
@@ -0,0 +1,296 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* trace writer running off the eval thread */
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "affinity.h"
+#include "probes.h"
+
+#if VM_TRACE_FST
+#include "gtkwave/fstapi.h"
+#endif // VM_TRACE_FST
+
+// Blocks of the ring between the eval thread and the writer thread, and bytes of each block.
+#define ASYNC_TRACE_NUM_BLOCKS 4
+#define ASYNC_TRACE_BLOCK_BYTES (1 << 20)
+// Bytes of VCD text buffered by the writer thread between two writes.
+#define ASYNC_TRACE_TEXT_BYTES (1 << 20)
+
+// Time unit of the trace, the default time precision with which Verilator traces top.sv, which sets no timescale.
+#define ASYNC_TRACE_TIMESCALE "1ps"
+
+/*
+ * Writes a trace on a background thread. After each tick, the eval thread compares the traced signals with their
+ * values at the previous tick and appends the changed ones to the current block of a preallocated ring: for each
+ * tick, the number of changed signals, then the id and the Verilator storage of each of them. The writer thread
+ * formats the blocks, in order, as VCD, or as FST with VM_TRACE_FST. Formatting and I/O never run on the eval
+ * thread, which only blocks when all the blocks are waiting for the writer, and memory stays bounded.
+ * The scopes are those of the trace of Verilator: the ports in TOP, and the ports and the internal signals in
+ * TOP.top, where the ports share the identifiers of TOP.
+ */
+class AsyncTraceWriter {
+  struct Block {
+    std::vector<uint8_t> bytes;
+    size_t num_bytes = 0;
+    // Handed over to the writer thread and not yet written.
+    bool full = false;
+  };
+
+  // The ports, then the internal signals.
+  std::vector<ProbeSignal> signals_;
+  size_t num_ports_;
+  // Eval thread only: the values of the signals at the last captured tick.
+  std::vector<uint8_t> last_values_;
+  std::vector<size_t> last_value_offsets_;
+  bool captured_ = false;
+  // Bytes of a tick in which all the signals change.
+  size_t max_tick_bytes_ = sizeof(uint32_t);
+
+  Block blocks_[ASYNC_TRACE_NUM_BLOCKS];
+  int fill_block_id_ = 0;
+  bool done_ = false;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread writer_;
+  uint64_t next_time_;
+  // CPU of the writer thread, or -1.
+  int cpu_;
+  // Writer thread only: the bits of a value, as text.
+  std::vector<char> bits_;
+
+#if VM_TRACE_FST
+  void *fst_ = NULL;
+  std::vector<fstHandle> fst_handles_;
+#else
+  FILE *vcd_ = NULL;
+  std::vector<std::string> vcd_ids_;
+  std::string text_;
+#endif // VM_TRACE_FST
+
+ public:
+  /* traces the ports and internal signals, whose data points to the storage of the simulated model, from time first_time on */
+  AsyncTraceWriter(const std::vector<ProbeSignal> &ports, const std::vector<ProbeSignal> &internals, uint64_t first_time, int cpu)
+      : signals_(ports), num_ports_(ports.size()), next_time_(first_time), cpu_(cpu) {
+    signals_.insert(signals_.end(), internals.begin(), internals.end());
+    for (const ProbeSignal &signal : signals_) {
+      last_value_offsets_.push_back(last_values_.size());
+      last_values_.resize(last_values_.size() + signal.num_bytes);
+      max_tick_bytes_ += sizeof(uint32_t) + signal.num_bytes;
+      bits_.resize(std::max(bits_.size(), (size_t) signal.width + 1));
+    }
+    for (Block &block : blocks_)
+      block.bytes.resize(std::max(max_tick_bytes_, (size_t) ASYNC_TRACE_BLOCK_BYTES));
+  }
+  ~AsyncTraceWriter() { close(); }
+
+  /* creates the trace file and starts the writer thread; returns false on error */
+  bool open(const std::string &path) {
+#if VM_TRACE_FST
+    fst_ = fstWriterCreate(path.c_str(), 1);
+    if (fst_ == NULL) { std::cerr << "Could not create trace file " << path << "." << std::endl; return false; }
+    fstWriterSetTimescaleFromString(fst_, ASYNC_TRACE_TIMESCALE);
+    fstWriterSetScope(fst_, FST_ST_VCD_MODULE, "TOP", NULL);
+    for (size_t signal_id = 0; signal_id < num_ports_; signal_id++)
+      fst_handles_.push_back(fstWriterCreateVar(fst_, FST_VT_VCD_WIRE, FST_VD_IMPLICIT, signals_[signal_id].width, declared_name(signals_[signal_id]).c_str(), 0));
+    fstWriterSetScope(fst_, FST_ST_VCD_MODULE, "top", NULL);
+    // The ports of top are aliases of those of TOP.
+    for (size_t signal_id = 0; signal_id < num_ports_; signal_id++)
+      fstWriterCreateVar(fst_, FST_VT_VCD_WIRE, FST_VD_IMPLICIT, signals_[signal_id].width, declared_name(signals_[signal_id]).c_str(), fst_handles_[signal_id]);
+    for (size_t signal_id = num_ports_; signal_id < signals_.size(); signal_id++)
+      fst_handles_.push_back(fstWriterCreateVar(fst_, FST_VT_VCD_WIRE, FST_VD_IMPLICIT, signals_[signal_id].width, declared_name(signals_[signal_id]).c_str(), 0));
+    fstWriterSetUpscope(fst_);
+    fstWriterSetUpscope(fst_);
+#else
+    vcd_ = fopen(path.c_str(), "w");
+    if (vcd_ == NULL) { std::cerr << "Could not create trace file " << path << "." << std::endl; return false; }
+    text_ = "$timescale " ASYNC_TRACE_TIMESCALE " $end\n";
+    for (size_t signal_id = 0; signal_id < signals_.size(); signal_id++)
+      vcd_ids_.push_back(vcd_identifier(signal_id));
+    text_ += "$scope module TOP $end\n";
+    for (size_t signal_id = 0; signal_id < num_ports_; signal_id++)
+      text_ += vcd_declaration(signal_id);
+    // The ports of top share the identifiers of those of TOP.
+    text_ += "$scope module top $end\n";
+    for (size_t signal_id = 0; signal_id < signals_.size(); signal_id++)
+      text_ += vcd_declaration(signal_id);
+    text_ += "$upscope $end\n$upscope $end\n$enddefinitions $end\n";
+#endif // VM_TRACE_FST
+    writer_ = std::thread(&AsyncTraceWriter::write_loop, this);
+    return true;
+  }
+
+  /* records the values of the signals that changed since the last call, as those of the next time step */
+  inline void capture() {
+    Block *block = &blocks_[fill_block_id_];
+    if (block->num_bytes + max_tick_bytes_ > block->bytes.size()) {
+      hand_over();
+      block = &blocks_[fill_block_id_];
+    }
+    uint8_t *tick_bytes = block->bytes.data() + block->num_bytes;
+    uint8_t *change = tick_bytes + sizeof(uint32_t);
+    uint32_t num_changes = 0;
+    for (uint32_t signal_id = 0; signal_id < signals_.size(); signal_id++) {
+      const ProbeSignal &signal = signals_[signal_id];
+      uint8_t *last_value = last_values_.data() + last_value_offsets_[signal_id];
+      // The first time step holds all the signals.
+      if (captured_ && !memcmp(last_value, signal.data, signal.num_bytes))
+        continue;
+      memcpy(last_value, signal.data, signal.num_bytes);
+      memcpy(change, &signal_id, sizeof(signal_id));
+      memcpy(change + sizeof(signal_id), signal.data, signal.num_bytes);
+      change += sizeof(signal_id) + signal.num_bytes;
+      num_changes++;
+    }
+    memcpy(tick_bytes, &num_changes, sizeof(num_changes));
+    block->num_bytes = change - block->bytes.data();
+    captured_ = true;
+  }
+
+  /* writes all the captured time steps and closes the trace file */
+  void close() {
+    if (!writer_.joinable())
+      return;
+    hand_over();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+  }
+
+ private:
+  void hand_over() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    blocks_[fill_block_id_].full = true;
+    cv_.notify_all();
+    fill_block_id_ = (fill_block_id_ + 1) % ASYNC_TRACE_NUM_BLOCKS;
+    // Only block the eval thread if the writer has not written the next block of the ring yet.
+    cv_.wait(lock, [this] { return !blocks_[fill_block_id_].full; });
+  }
+
+  void write_loop() {
+    // A failure to pin is reported by pin_thread, and only costs the isolation from the eval threads.
+    if (cpu_ >= 0)
+      pin_thread(current_thread_id(), &cpu_, 1);
+
+    int drain_block_id = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this, drain_block_id] { return blocks_[drain_block_id].full || done_; });
+        // Blocks are handed over in order, so nothing is left once the next one is not full.
+        if (!blocks_[drain_block_id].full)
+          break;
+      }
+
+      Block &block = blocks_[drain_block_id];
+      write_block(block);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        block.num_bytes = 0;
+        block.full = false;
+      }
+      cv_.notify_all();
+      drain_block_id = (drain_block_id + 1) % ASYNC_TRACE_NUM_BLOCKS;
+    }
+
+#if VM_TRACE_FST
+    fstWriterClose(fst_);
+#else
+    fwrite(text_.data(), 1, text_.size(), vcd_);
+    fclose(vcd_);
+#endif // VM_TRACE_FST
+  }
+
+  void write_block(const Block &block) {
+    const uint8_t *curr = block.bytes.data();
+    const uint8_t *end = curr + block.num_bytes;
+    while (curr < end) {
+      uint32_t num_changes;
+      memcpy(&num_changes, curr, sizeof(num_changes));
+      curr += sizeof(num_changes);
+      uint64_t time = next_time_++;
+#if VM_TRACE_FST
+      fstWriterEmitTimeChange(fst_, time);
+#else
+      if (num_changes > 0)
+        text_ += "#" + std::to_string(time) + "\n";
+#endif // VM_TRACE_FST
+      for (uint32_t change_id = 0; change_id < num_changes; change_id++) {
+        uint32_t signal_id;
+        memcpy(&signal_id, curr, sizeof(signal_id));
+        const ProbeSignal &signal = signals_[signal_id];
+        char *value_bits = bits_.data();
+        format_bits(curr + sizeof(signal_id), signal.width, value_bits);
+        curr += sizeof(signal_id) + signal.num_bytes;
+#if VM_TRACE_FST
+        fstWriterEmitValueChange(fst_, fst_handles_[signal_id], value_bits);
+#else
+        if (signal.width == 1) {
+          text_ += value_bits[0];
+        } else {
+          // Leading zeros are implied in VCD.
+          const char *first_one = strchr(value_bits, '1');
+          text_ += 'b';
+          text_ += first_one == NULL ? "0" : first_one;
+          text_ += ' ';
+        }
+        text_ += vcd_ids_[signal_id];
+        text_ += '\n';
+#endif // VM_TRACE_FST
+      }
+#if !VM_TRACE_FST
+      if (text_.size() >= ASYNC_TRACE_TEXT_BYTES) {
+        fwrite(text_.data(), 1, text_.size(), vcd_);
+        text_.clear();
+      }
+#endif // !VM_TRACE_FST
+    }
+  }
+
+  /* the name of a signal as Verilator declares it, with its bit range if it has more than one bit */
+  static std::string declared_name(const ProbeSignal &signal) {
+    if (signal.width == 1)
+      return signal.name;
+    return std::string(signal.name) + " [" + std::to_string(signal.width - 1) + ":0]";
+  }
+
+#if !VM_TRACE_FST
+  std::string vcd_declaration(size_t signal_id) const {
+    return "$var wire " + std::to_string(signals_[signal_id].width) + " " + vcd_ids_[signal_id] + " " + declared_name(signals_[signal_id]) + " $end\n";
+  }
+#endif // !VM_TRACE_FST
+
+  /* writes the width bits of a value in Verilator storage, most significant first, as a C string */
+  static void format_bits(const uint8_t *value, int width, char *bits) {
+    for (int bit_id = 0; bit_id < width; bit_id++)
+      bits[width - 1 - bit_id] = (value[bit_id / 8] >> (bit_id % 8)) & 1 ? '1' : '0';
+    bits[width] = '\0';
+  }
+
+  /* the printable identifier of a signal in a VCD, as decode_probes.py writes them */
+  static std::string vcd_identifier(size_t signal_id) {
+    std::string identifier;
+    signal_id++;
+    while (signal_id > 0) {
+      signal_id--;
+      identifier += (char) (33 + signal_id % 94);
+      signal_id /= 94;
+    }
+    return identifier;
+  }
+};
@@ -0,0 +1,122 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Generates synthetic designs of increasing size with gen_design.py, builds each of them with tb_base.cc,
+# and reports the build time and the simulation cost per tick of every configuration.
+# Usage: python3 bench_designs.py [--simlen 100000] [--csv results.csv]
+
+import argparse
+import json
+import multiprocessing as mp
+import os
+import random
+import shutil
+import struct
+import subprocess
+import time
+
+from gen_design import DEFAULT_OP_MIX, DesignGenerator, write_interface_sizes
+
+REPO_DIR = os.path.dirname(os.path.abspath(__file__))
+BENCH_DIR = os.path.abspath('bench_designs')
+
+# (name, in width, out width, number of signals, depth, max signal width, operator mix)
+CONFIGURATIONS = [
+    ('small',       64,   32,   32,  4,  64, DEFAULT_OP_MIX),
+    ('top_like',   288,  160,  186,  8, 300, DEFAULT_OP_MIX),
+    ('wide',      1024,  512,  186,  8, 1024, DEFAULT_OP_MIX),
+    ('deep',       288,  160,  186, 32, 300, DEFAULT_OP_MIX),
+    ('large',      288,  160, 1024, 16, 300, DEFAULT_OP_MIX),
+    ('arith',      288,  160,  186,  8, 300, {'div': 4, 'mod': 4, 'pow': 4, 'shift': 1, 'red': 0, 'eq': 0, 'concat': 1}),
+    ('bitwise',    288,  160,  186,  8, 300, {'div': 0, 'mod': 0, 'pow': 0, 'shift': 4, 'red': 4, 'eq': 4, 'concat': 4}),
+]
+
+# Headers included by tb_base.cc. The headers generated for top.sv, such as coverage_signals.h and probe_table.h, are left out.
+HARNESS_HEADERS = ['affinity.h', 'async_trace.h', 'checkpoint.h', 'coverage.h', 'digest.h', 'harness.h', 'memo.h', 'probes.h', 'stimulus.h', 'tick_stats.h', 'ticks.h']
+
+VERILATOR_FLAGS = "--cc --exe --Wno-UNOPTFLAT --Wno-WIDTHTRUNC --Wno-CMPCONST -Wno-WIDTHEXPAND -Wno-WIDTH"
+
+def write_stimulus(path: str, in_width: int, simlen: int, seed: int):
+    # Binary stimulus format of stimulus.h, full random.
+    words_per_tick = (in_width + 31) // 32
+    rng = random.Random(seed)
+    with open(path, 'wb') as f:
+        f.write(b'TBSTIM01' + struct.pack('<IIQ', in_width, words_per_tick, simlen))
+        f.write(rng.randbytes(4 * words_per_tick * simlen))
+
+# Generates and builds one configuration; returns its build time in seconds, or None on failure.
+def build(configuration, simlen: int, seed: int):
+    name, in_width, out_width, num_signals, depth, max_width, op_mix = configuration
+    design_dir = os.path.join(BENCH_DIR, name)
+    os.makedirs(design_dir, exist_ok=True)
+
+    # Each design gets its own copy of the harness, next to its own interface_sizes.h.
+    generator = DesignGenerator(in_width, out_width, num_signals, depth, max_width, op_mix, seed)
+    with open(os.path.join(design_dir, 'top.sv'), 'w') as f:
+        f.write(generator.generate())
+    write_interface_sizes(os.path.join(design_dir, 'interface_sizes.h'), in_width, out_width, os.path.join(design_dir, 'random_inputs.txt'))
+    shutil.copy(os.path.join(REPO_DIR, 'tb_base.cc'), design_dir)
+    for header in HARNESS_HEADERS:
+        shutil.copy(os.path.join(REPO_DIR, header), design_dir)
+    write_stimulus(os.path.join(design_dir, 'inputs.bin'), in_width, simlen, seed)
+
+    build_start = time.monotonic()
+    verilate_cmd_str = f"verilator {VERILATOR_FLAGS} --build tb_base.cc top.sv -CFLAGS '-O2' --Mdir obj_dir --build-jobs 4"
+    try:
+        subprocess.run(verilate_cmd_str, shell=True, check=True, cwd=design_dir, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    except:
+        print(f"Failed verilation of {name}")
+        return None
+    return time.monotonic() - build_start
+
+# Returns the wall-clock nanoseconds of a run of simlen ticks, without any instrumentation.
+def time_run(design_dir: str, simlen: int):
+    run_start = time.perf_counter_ns()
+    subprocess.run(f"STIMFILE=inputs.bin SIMLEN={simlen} obj_dir/Vtop", shell=True, check=True, cwd=design_dir, stdout=subprocess.DEVNULL)
+    return time.perf_counter_ns() - run_start
+
+def run(configuration, simlen: int, build_s: float):
+    name = configuration[0]
+    design_dir = os.path.join(BENCH_DIR, name)
+    # The cost per tick is measured without STATSFILE, whose per-phase timing would be part of it.
+    # The run of a single tick is subtracted, to leave out the process startup and the construction of the model.
+    ns_per_tick = (time_run(design_dir, simlen) - time_run(design_dir, 1)) / max(simlen - 1, 1)
+
+    # The per-phase statistics come from a separate, instrumented run.
+    run_cmd_str = f"STIMFILE=inputs.bin STATSFILE=stats.json SIMLEN={simlen} obj_dir/Vtop"
+    subprocess.run(run_cmd_str, shell=True, check=True, cwd=design_dir, stdout=subprocess.DEVNULL)
+    with open(os.path.join(design_dir, 'stats.json'), 'r') as f:
+        stats = json.load(f)
+    tick_stats = stats['phases']['tick']
+    return {
+        'name': name,
+        'build_s': build_s,
+        'ns_per_tick': ns_per_tick,
+        'stats_ns_per_tick': stats['elapsed_ns'] / simlen,
+        'eval_mean_ns': stats['phases']['eval']['mean_ns'],
+        'tick_p50_ns': tick_stats['p50_ns'],
+        'tick_p99_ns': tick_stats['p99_ns'],
+    }
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--simlen', type=int, default=100000)
+    parser.add_argument('--seed', type=int, default=0)
+    parser.add_argument('--csv', default=None)
+    args = parser.parse_args()
+
+    # Builds run in parallel, but the simulations run one after the other so that they do not perturb each other.
+    with mp.Pool(max(1, mp.cpu_count() // 4)) as pool:
+        build_times = pool.starmap(build, [(configuration, args.simlen, args.seed) for configuration in CONFIGURATIONS])
+    results = [run(configuration, args.simlen, build_s) for configuration, build_s in zip(CONFIGURATIONS, build_times) if build_s is not None]
+
+    columns = ['name', 'build_s', 'ns_per_tick', 'stats_ns_per_tick', 'eval_mean_ns', 'tick_p50_ns', 'tick_p99_ns']
+    print(' '.join(f"{column:>17}" for column in columns))
+    for result in results:
+        print(' '.join(f"{result[column]:>17.1f}" if column != 'name' else f"{result[column]:>17}" for column in columns))
+    if args.csv is not None:
+        with open(args.csv, 'w') as f:
+            f.write(','.join(columns) + '\n')
+            for result in results:
+                f.write(','.join(str(result[column]) for column in columns) + '\n')
@@ -0,0 +1,154 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Builds verilated variants of top.sv with the makefiles that Verilator generates for them, and reuses the objects of
+# translation units whose compile command and preprocessed content did not change across variants or runs.
+# The compiler is wrapped through the OBJCACHE hook of verilated.mk, so each unit is compiled with the flags and defines
+# of the generated makefiles, as in an uncached build, and these are part of the key of its object. The only addition
+# is a precompiled verilated.h, force-included into the units that include verilated.h anyway.
+# Usage: python3 build_cache.py <out_dir> [--verilator-flags='--trace -fno-gate'] [--harness tb_base.cc] [--cflags '-g']
+
+import argparse
+import fcntl
+import glob
+import hashlib
+import os
+import re
+import shlex
+import shutil
+import subprocess
+import sys
+
+REPO_DIR = os.path.dirname(os.path.abspath(__file__))
+CACHE_DIR = os.path.join(REPO_DIR, 'build_cache')
+PCH_DIR = os.path.join(CACHE_DIR, 'pch')
+OBJECTS_DIR = os.path.join(CACHE_DIR, 'objects')
+
+VERILATOR_FLAGS = "--cc --exe --Wno-UNOPTFLAT --Wno-WIDTHTRUNC --Wno-CMPCONST -Wno-WIDTHEXPAND"
+# Header shared by most translation units, precompiled once per set of compile flags.
+PCH_HEADER = 'verilated.h'
+DEFAULT_CFLAGS = '-g'
+# Set by build_model for the wrapped compiles, which append "hit" or "miss" to it for every unit.
+LOG_ENV = 'BUILD_CACHE_LOG'
+# Set by build_model to the toolchain id, so that the wrapped compiles do not compute it again for every unit.
+TOOLCHAIN_ENV = 'BUILD_CACHE_TOOLCHAIN'
+
+def run(cmd_str: str, cwd: str = REPO_DIR):
+    subprocess.run(cmd_str, shell=True, check=True, cwd=cwd, stdout=subprocess.DEVNULL)
+
+def toolchain_id(compiler: str):
+    # Identifies the compiler, Verilator and the Verilator headers, which the precompiled header and the objects depend on.
+    # GCC does not check that a precompiled header is newer than its sources, so the content of the headers is part of it.
+    toolchain = hashlib.sha256()
+    toolchain.update(subprocess.run([compiler, '--version'], stdout=subprocess.PIPE).stdout)
+    toolchain.update(subprocess.run(['verilator', '--version'], stdout=subprocess.PIPE).stdout)
+    root = subprocess.run(['verilator', '--getenv', 'VERILATOR_ROOT'], stdout=subprocess.PIPE).stdout.decode('utf-8').strip()
+    for header_path in sorted(glob.glob(os.path.join(root, 'include', '**', '*.h'), recursive=True)):
+        with open(header_path, 'rb') as f:
+            toolchain.update(header_path.encode() + b'\0' + f.read())
+    return toolchain.hexdigest()
+
+def publish_once(path: str, produce):
+    # Produces path with produce(tmp_path) unless it exists, and returns whether it existed. Concurrent builds wait for each other.
+    if os.path.exists(path):
+        return True
+    os.makedirs(os.path.dirname(path), exist_ok=True)
+    with open(f"{path}.lock", 'w') as lock:
+        fcntl.flock(lock, fcntl.LOCK_EX)
+        if os.path.exists(path):
+            return True
+        tmp_path = f"{path}.{os.getpid()}.tmp"
+        try:
+            produce(tmp_path)
+        except subprocess.CalledProcessError:
+            # The compiler may leave a partial output behind.
+            if os.path.exists(tmp_path):
+                os.remove(tmp_path)
+            raise
+        os.replace(tmp_path, path)
+    return False
+
+def precompiled_header(compiler: str, flags: list, toolchain: str):
+    # Returns the precompiled header of PCH_HEADER for this toolchain and these flags, which the header must have been
+    # compiled with, or None if it does not compile with them.
+    flags_hash = hashlib.sha256(toolchain.encode() + b'\0' + shlex.join([compiler] + flags).encode()).hexdigest()[:16]
+    header_path = os.path.join(PCH_DIR, flags_hash, 'verilated_pch.h')
+    if not os.path.exists(header_path):
+        os.makedirs(os.path.dirname(header_path), exist_ok=True)
+        with open(f"{header_path}.{os.getpid()}.tmp", 'w') as f:
+            f.write(f"#include \"{PCH_HEADER}\"\n")
+        os.replace(f"{header_path}.{os.getpid()}.tmp", header_path)
+    try:
+        publish_once(f"{header_path}.gch", lambda tmp_path: subprocess.run([compiler] + flags + ['-x', 'c++-header', header_path, '-o', tmp_path], check=True, stderr=subprocess.DEVNULL))
+    except subprocess.CalledProcessError:
+        # The unit is then compiled without it.
+        return None
+    return header_path
+
+def compile_unit(command: list):
+    # Runs one compile command of the generated makefiles, through the object cache. Other commands run unchanged.
+    if '-c' not in command or '-o' not in command or os.path.splitext(command[-1])[1] not in ('.cpp', '.cc'):
+        return subprocess.run(command).returncode
+    compiler, source_path = command[0], command[-1]
+    output_index = command.index('-o')
+    object_path = command[output_index + 1]
+    # The flags without the output, the source and the dependency file options, which name files of this build only.
+    flags = [arg for arg_id, arg in enumerate(command[1:-1], 1) if arg_id not in (output_index, output_index + 1) and arg not in ('-c', '-MMD', '-MP')]
+
+    toolchain = os.environ.get(TOOLCHAIN_ENV) or toolchain_id(compiler)
+    preprocessed = subprocess.run([compiler] + flags + ['-E', source_path], stdout=subprocess.PIPE)
+    if preprocessed.returncode != 0:
+        return preprocessed.returncode
+    # The line markers tell whether the unit includes verilated.h, even through other headers, and are then left out of
+    # the key, as they hold the paths of the variant directories.
+    line_marker = re.compile(rb'^# \d+ "([^"]*)".*$\n?', re.MULTILINE)
+    included_paths = set(line_marker.findall(preprocessed.stdout))
+    content = line_marker.sub(b'', preprocessed.stdout)
+    # Only the units that include verilated.h anyway get it precompiled.
+    includes_pch_header = any(os.path.basename(path) == PCH_HEADER.encode() for path in included_paths)
+    header_path = precompiled_header(compiler, flags, toolchain) if includes_pch_header else None
+    pch_flags = [] if header_path is None else ['-Winvalid-pch', '-include', header_path]
+    object_key = toolchain.encode() + b'\0' + shlex.join([compiler] + flags + pch_flags).encode() + b'\0' + content
+    object_hash = hashlib.sha256(object_key).hexdigest()
+    cached_path = os.path.join(OBJECTS_DIR, object_hash[:2], f"{object_hash}.o")
+
+    try:
+        hit = publish_once(cached_path, lambda tmp_path: subprocess.run([compiler] + flags + pch_flags + ['-c', '-o', tmp_path, source_path], check=True))
+    except subprocess.CalledProcessError as error:
+        return error.returncode
+    shutil.copyfile(cached_path, object_path)
+    if os.environ.get(LOG_ENV):
+        with open(os.environ[LOG_ENV], 'a') as f:
+            f.write('hit\n' if hit else 'miss\n')
+    return 0
+
+def build_model(out_dir: str, verilator_flags: str = '', harness: str = 'tb_base.cc', cflags: str = DEFAULT_CFLAGS, build_jobs: int = 4):
+    # Verilates top.sv into out_dir and builds out_dir/Vtop with the generated makefiles; returns the number of cache hits and misses.
+    shutil.rmtree(out_dir, ignore_errors=True)
+    run(f"verilator {VERILATOR_FLAGS} {verilator_flags} {harness} top.sv -CFLAGS {shlex.quote(cflags)} --Mdir {out_dir}")
+
+    # The toolchain is identified once per model rather than once per unit, with the compiler of the generated makefiles.
+    compiler = subprocess.run(['make', '-s', '-f', 'Vtop.mk', '--eval=print-cxx: ; @echo $(CXX)', 'print-cxx'], check=True, cwd=out_dir,
+                              stdout=subprocess.PIPE).stdout.decode('utf-8').strip()
+    log_path = os.path.join(out_dir, 'build_cache.log')
+    objcache = shlex.join([sys.executable, os.path.abspath(__file__), '--compile'])
+    subprocess.run(['make', '-j', str(build_jobs), '-f', 'Vtop.mk', f"OBJCACHE={objcache}"], check=True, cwd=out_dir,
+                   env=dict(os.environ, **{LOG_ENV: log_path, TOOLCHAIN_ENV: toolchain_id(compiler)}), stdout=subprocess.DEVNULL)
+    with open(log_path, 'r') as f:
+        outcomes = f.read().split()
+    return outcomes.count('hit'), outcomes.count('miss')
+
+if __name__ == '__main__':
+    if len(sys.argv) > 2 and sys.argv[1] == '--compile':
+        sys.exit(compile_unit(sys.argv[2:]))
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument('out_dir')
+    parser.add_argument('--verilator-flags', default='')
+    parser.add_argument('--harness', default='tb_base.cc')
+    parser.add_argument('--cflags', default=DEFAULT_CFLAGS)
+    args = parser.parse_args()
+
+    num_hits, num_misses = build_model(os.path.abspath(args.out_dir), args.verilator_flags, args.harness, args.cflags)
+    print(f"Built {os.path.join(args.out_dir, 'Vtop')}: {num_hits} cached and {num_misses} compiled translation units.")
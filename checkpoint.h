@@ -0,0 +1,157 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* periodic checkpoints of the harness and model state, restored to trace a window of ticks */
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Define CHECKPOINT_MODEL_STATE=1 when verilating with --savable to also checkpoint the model state.
+// top is purely combinational, so the harness state alone is enough to resume it.
+#ifndef CHECKPOINT_MODEL_STATE
+#define CHECKPOINT_MODEL_STATE 0
+#endif
+#if CHECKPOINT_MODEL_STATE
+#include <verilated_save.h>
+#endif
+
+/*
+ * A checkpoint taken before running tick tick_id is the file <dir>/checkpoint_<tick_id>.bin,
+ * holding a CheckpointHeader, and with CHECKPOINT_MODEL_STATE the file <dir>/checkpoint_<tick_id>.model.
+ * A checkpoint is only restored by a run of the same stimulus and simulation length.
+ */
+#define CHECKPOINT_MAGIC "TBCKPT02"
+
+struct CheckpointHeader {
+  char magic[8];
+  uint64_t tick_id;
+  uint64_t curr_id_in_random_inputs_from_file;
+  uint64_t cumulated_output;
+  uint32_t digest_chain;
+  uint32_t has_model_state;
+  uint64_t stimulus_fingerprint;
+  uint64_t simlen;
+};
+
+#define CHECKPOINT_FINGERPRINT_SEED 0xcbf29ce484222325ULL
+
+/* FNV-1a hash of bytes, continuing from hash, such as the words of a stimulus that was loaded */
+static uint64_t checkpoint_fingerprint(const void *bytes, size_t num_bytes, uint64_t hash = CHECKPOINT_FINGERPRINT_SEED)
+{
+  for(size_t i = 0; i < num_bytes; i++) {
+    hash ^= ((const unsigned char *) bytes)[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+/* hash of a description of the stimulus of a run, such as its generator parameters or its file */
+static uint64_t checkpoint_fingerprint(const std::string &stimulus_description)
+{
+  return checkpoint_fingerprint(stimulus_description.data(), stimulus_description.size());
+}
+
+static std::string checkpoint_path(const std::string &dir, uint64_t tick_id, const char *extension)
+{
+  return dir + "/checkpoint_" + std::to_string(tick_id) + extension;
+}
+
+static bool checkpoint_create_dir(const std::string &dir)
+{
+  if(mkdir(dir.c_str(), 0755) && errno != EEXIST) {
+    std::cerr << "Could not create checkpoint directory " << dir << "." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+template <typename ModelT>
+static bool checkpoint_save(const std::string &dir, CheckpointHeader header, ModelT *my_module)
+{
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.has_model_state = CHECKPOINT_MODEL_STATE;
+  std::string path = checkpoint_path(dir, header.tick_id, ".bin");
+  FILE *f = fopen(path.c_str(), "wb");
+  if(f == NULL || fwrite(&header, sizeof(header), 1, f) != 1) {
+    std::cerr << "Could not write checkpoint " << path << "." << std::endl;
+    if(f != NULL) fclose(f);
+    return false;
+  }
+  fclose(f);
+#if CHECKPOINT_MODEL_STATE
+  VerilatedSave os;
+  std::string model_path = checkpoint_path(dir, header.tick_id, ".model");
+  os.open(model_path.c_str());
+  if(!os.isOpen()) {
+    std::cerr << "Could not write checkpoint " << model_path << "." << std::endl;
+    return false;
+  }
+  os << *my_module;
+  os.close();
+#endif
+  return true;
+}
+
+/* finds the latest checkpoint taken at or before tick_id; returns false if there is none */
+static bool checkpoint_find_nearest(const std::string &dir, uint64_t tick_id, uint64_t *found_tick_id)
+{
+  DIR *dirp = opendir(dir.c_str());
+  if(dirp == NULL)
+    return false;
+  bool found = false;
+  while(struct dirent *entry = readdir(dirp)) {
+    unsigned long long entry_tick_id;
+    char extension[8];
+    if(sscanf(entry->d_name, "checkpoint_%llu.%7s", &entry_tick_id, extension) != 2 || strcmp(extension, "bin"))
+      continue;
+    if(entry_tick_id <= tick_id && (!found || entry_tick_id > *found_tick_id)) {
+      *found_tick_id = entry_tick_id;
+      found = true;
+    }
+  }
+  closedir(dirp);
+  return found;
+}
+
+/* restores the checkpoint of tick_id, which must have been taken with the given stimulus fingerprint and simlen */
+template <typename ModelT>
+static bool checkpoint_restore(const std::string &dir, uint64_t tick_id, uint64_t stimulus_fingerprint, uint64_t simlen, CheckpointHeader *header, ModelT *my_module)
+{
+  std::string path = checkpoint_path(dir, tick_id, ".bin");
+  FILE *f = fopen(path.c_str(), "rb");
+  bool read_ok = f != NULL && fread(header, sizeof(*header), 1, f) == 1 && !memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic));
+  if(f != NULL) fclose(f);
+  if(!read_ok || header->tick_id != tick_id) {
+    std::cerr << "Could not read checkpoint " << path << "." << std::endl;
+    return false;
+  }
+  if(header->has_model_state != CHECKPOINT_MODEL_STATE) {
+    std::cerr << "Checkpoint " << path << " was taken by a build with a different CHECKPOINT_MODEL_STATE." << std::endl;
+    return false;
+  }
+  if(header->stimulus_fingerprint != stimulus_fingerprint || header->simlen != simlen) {
+    std::cerr << "Checkpoint " << path << " was taken with a different stimulus or SIMLEN." << std::endl;
+    return false;
+  }
+#if CHECKPOINT_MODEL_STATE
+  VerilatedRestore os;
+  std::string model_path = checkpoint_path(dir, tick_id, ".model");
+  os.open(model_path.c_str());
+  if(!os.isOpen()) {
+    std::cerr << "Could not read checkpoint " << model_path << "." << std::endl;
+    return false;
+  }
+  os >> *my_module;
+  os.close();
+#endif
+  return true;
+}
@@ -0,0 +1,48 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Finds the first tick at which two per-tick output digest logs differ.
+# Each log is either a binary log written by the harness (DIGESTFILE, see digest.h)
+# or a text log with one hexadecimal digest per line, as written by tb_icarus.sv.
+# Usage: python3 compare_digests.py trace_a.bin trace_b.txt
+
+import struct
+import sys
+
+DIGEST_LOG_MAGIC = b'TBDIGST1'
+DIGEST_LOG_HEADER_SIZE = 24
+
+def read_digests(path: str):
+    with open(path, 'rb') as f:
+        content = f.read()
+    if content.startswith(DIGEST_LOG_MAGIC):
+        num_ticks = struct.unpack_from('<Q', content, 16)[0]
+        body = content[DIGEST_LOG_HEADER_SIZE:DIGEST_LOG_HEADER_SIZE + 4 * num_ticks]
+        return body[:len(body) - len(body) % 4]
+    digests = [int(line, 16) for line in content.decode('ascii').split()]
+    return struct.pack(f'<{len(digests)}I', *digests)
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        print(f"Usage: {sys.argv[0]} <digest log> <digest log>")
+        sys.exit(2)
+    digests_a, digests_b = read_digests(sys.argv[1]), read_digests(sys.argv[2])
+    num_common_ticks = min(len(digests_a), len(digests_b)) // 4
+
+    # Compare large blocks first and only scan the first mismatching block tick by tick.
+    block_ticks = 1 << 16
+    for block_start in range(0, num_common_ticks, block_ticks):
+        block_end = min(block_start + block_ticks, num_common_ticks)
+        if digests_a[4 * block_start:4 * block_end] == digests_b[4 * block_start:4 * block_end]:
+            continue
+        for tick_id in range(block_start, block_end):
+            digest_a, digest_b = struct.unpack_from('<I', digests_a, 4 * tick_id)[0], struct.unpack_from('<I', digests_b, 4 * tick_id)[0]
+            if digest_a != digest_b:
+                print(f"First divergence at tick {tick_id}: 0x{digest_a:08x} vs 0x{digest_b:08x}.")
+                sys.exit(1)
+
+    if len(digests_a) != len(digests_b):
+        print(f"No divergence over the {num_common_ticks} common ticks, but the logs have {len(digests_a) // 4} and {len(digests_b) // 4} ticks.")
+        sys.exit(1)
+    print(f"No divergence over {num_common_ticks} ticks.")
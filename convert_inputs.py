@@ -0,0 +1,34 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Converts a decimal text stimulus (such as inputs.txt) into the binary stimulus format of stimulus.h.
+# Usage: python3 convert_inputs.py inputs.txt inputs.bin [--in-data-width 288] [--full-random]
+
+import argparse
+import struct
+import sys
+
+STIMULUS_MAGIC = b'TBSTIM01'
+
+parser = argparse.ArgumentParser()
+parser.add_argument('text_path')
+parser.add_argument('bin_path')
+parser.add_argument('--in-data-width', type=int, default=288)
+parser.add_argument('--full-random', action='store_true')
+args = parser.parse_args()
+
+words_per_tick = (args.in_data_width + 31) // 32 if args.full_random else 1
+
+with open(args.text_path, 'r') as f:
+    words = [int(token) & 0xffffffff for token in f.read().split()]
+
+num_ticks = len(words) // words_per_tick
+if num_ticks * words_per_tick != len(words):
+    print(f"Ignoring the last {len(words) - num_ticks * words_per_tick} words, which do not form a full tick.", file=sys.stderr)
+
+with open(args.bin_path, 'wb') as f:
+    f.write(STIMULUS_MAGIC + struct.pack('<IIQ', args.in_data_width, words_per_tick, num_ticks))
+    f.write(struct.pack(f'<{num_ticks * words_per_tick}I', *words[:num_ticks * words_per_tick]))
+
+print(f"Wrote {num_ticks} ticks to {args.bin_path}.")
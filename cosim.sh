@@ -0,0 +1,21 @@
+# Co-simulates top.sv under Icarus and Verilator, checking the outputs tick by tick through shared memory.
+# Runs SIMLEN ticks (default 10) of STIMFILE, or else of the stimulus generated from SEED (default 0).
+SIMLEN=${SIMLEN:-10}
+if [ -z "$STIMFILE" ]; then
+  export SEED=${SEED:-0}
+fi
+verilator --cc --exe --Wno-UNOPTFLAT --Wno-WIDTHTRUNC --Wno-CMPCONST -Wno-WIDTHEXPAND --build tb_cosim.cc top.sv -CFLAGS '-O2' --Mdir obj_dir_cosim -o Vcosim --build-jobs 100
+
+iverilog-vpi cosim_vpi.cc
+rm -rf icarus_obj_dir_cosim && mkdir -p icarus_obj_dir_cosim && iverilog -g2012 -DCOSIM -DSIMLEN=$SIMLEN -o icarus_obj_dir_cosim/Vtop top.sv tb_icarus.sv
+
+# Remove the ring of a previous run, so that vvp cannot attach to it before Vcosim replaces it.
+# Vcosim records its pid in the ring as well, and cosim_vpi skips the rings of consumers that are gone.
+rm -f "/dev/shm${COSIM_RING:-/tbcosim}"
+obj_dir_cosim/Vcosim &
+COSIM_PID=$!
+# Vcosim also gives up on its own once vvp is gone, but do not wait for it if vvp failed.
+if ! vvp -M . -mcosim_vpi icarus_obj_dir_cosim/Vtop; then
+  kill $COSIM_PID 2>/dev/null
+fi
+wait $COSIM_PID
@@ -0,0 +1,252 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* single-producer single-consumer ring of per-tick input and output vectors in POSIX shared memory */
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The consumer (tb_cosim) creates the ring, and the producer (the cosim_vpi module under Icarus) attaches to it.
+ * Each slot holds the input words then the output words of one tick. head counts the slots written by the
+ * producer and tail the slots read by the consumer; each side only writes its own counter, with release
+ * semantics, and reads the other one with acquire semantics.
+ * The producer publishes its pid when it attaches, so that a consumer waiting for ticks notices when the
+ * producer never attached or exited without finishing. Likewise, the consumer records its pid when it creates
+ * the ring, so that the producer does not attach to the stale ring of a consumer that crashed.
+ */
+#define COSIM_RING_MAGIC "TBCSIM02"
+#define COSIM_RING_DEFAULT_SLOTS (1 << 14)
+// Time the producer has to attach, from the creation of the ring.
+#define COSIM_RING_PRODUCER_TIMEOUT_MS 30000
+// Waits of the consumer between two checks that the producer is alive.
+#define COSIM_RING_LIVENESS_WAITS 4096
+
+struct CosimRingHeader {
+  char magic[8];
+  uint32_t num_in_words;
+  uint32_t num_out_words;
+  uint64_t num_slots;
+  // Set by the producer after its last tick, and by the consumer to stop the producer early.
+  uint32_t producer_done;
+  uint32_t consumer_abort;
+  uint32_t producer_pid;
+  uint32_t consumer_pid;
+  alignas(64) uint64_t head;
+  alignas(64) uint64_t tail;
+};
+
+struct CosimRing {
+  CosimRingHeader *header = NULL;
+  uint32_t *slots = NULL;
+  size_t map_len = 0;
+  uint32_t slot_words = 0;
+  // Last value read of the other side's counter, to only touch its cache line when needed.
+  uint64_t cached_counter = 0;
+  // Consumer side: creation time of the ring, and whether the producer went away without finishing.
+  struct timespec created_at = {0, 0};
+  bool producer_lost = false;
+};
+
+static size_t cosim_ring_map_len(uint32_t num_in_words, uint32_t num_out_words, uint64_t num_slots)
+{
+  return sizeof(CosimRingHeader) + num_slots * (num_in_words + num_out_words) * sizeof(uint32_t);
+}
+
+static bool cosim_ring_map(CosimRing *ring, int fd, size_t map_len)
+{
+  void *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) return false;
+  ring->header = (CosimRingHeader *) map;
+  ring->map_len = map_len;
+  ring->slots = (uint32_t *) ((char *) map + sizeof(CosimRingHeader));
+  return true;
+}
+
+/* creates the ring, replacing any stale one of the same name; num_slots must be a power of two */
+static bool cosim_ring_create(CosimRing *ring, const char *name, uint32_t num_in_words, uint32_t num_out_words, uint64_t num_slots)
+{
+  shm_unlink(name);
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  size_t map_len = cosim_ring_map_len(num_in_words, num_out_words, num_slots);
+  if(fd < 0) { std::cerr << "Could not create the cosimulation ring " << name << "." << std::endl; return false; }
+  // cosim_ring_map closes fd, so it is only left to close if ftruncate fails.
+  bool mapped = false;
+  if(ftruncate(fd, map_len) == 0) mapped = cosim_ring_map(ring, fd, map_len);
+  else close(fd);
+  if(!mapped) {
+    // Do not leave a ring that no producer could use behind.
+    shm_unlink(name);
+    std::cerr << "Could not create the cosimulation ring " << name << "." << std::endl; return false;
+  }
+  CosimRingHeader *header = ring->header;
+  header->num_in_words = num_in_words;
+  header->num_out_words = num_out_words;
+  header->num_slots = num_slots;
+  header->consumer_pid = getpid();
+  ring->slot_words = num_in_words + num_out_words;
+  clock_gettime(CLOCK_MONOTONIC, &ring->created_at);
+  // The magic is published last, so that a producer never sees a half-initialized header.
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(header->magic, COSIM_RING_MAGIC, sizeof(header->magic));
+  return true;
+}
+
+/* whether a process, such as the other side of a ring, is still running */
+static bool cosim_ring_pid_alive(pid_t pid)
+{
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/* attaches to a ring created by a running consumer, waiting up to timeout_ms for it to appear */
+static bool cosim_ring_attach(CosimRing *ring, const char *name, uint32_t num_in_words, uint32_t num_out_words, int timeout_ms)
+{
+  struct timespec poll_period = {0, 10 * 1000 * 1000};
+  for (int waited_ms = 0; ; waited_ms += 10) {
+    int fd = shm_open(name, O_RDWR, 0600);
+    struct stat st;
+    if(fd >= 0 && fstat(fd, &st) == 0 && (size_t) st.st_size > sizeof(CosimRingHeader)) {
+      if(!cosim_ring_map(ring, fd, st.st_size)) break;
+      // The ring of a consumer that is gone is stale, so wait for the new consumer to replace it.
+      if(!memcmp(ring->header->magic, COSIM_RING_MAGIC, sizeof(ring->header->magic))) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(cosim_ring_pid_alive(ring->header->consumer_pid))
+          break;
+      }
+      munmap(ring->header, ring->map_len);
+      ring->header = NULL;
+    } else if(fd >= 0) {
+      close(fd);
+    }
+    if(waited_ms >= timeout_ms) {
+      std::cerr << "Timed out waiting for the cosimulation ring " << name << "." << std::endl; return false;
+    }
+    nanosleep(&poll_period, NULL);
+  }
+  if(ring->header == NULL) { std::cerr << "Could not map the cosimulation ring " << name << "." << std::endl; return false; }
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if(ring->header->num_in_words != num_in_words || ring->header->num_out_words != num_out_words) {
+    std::cerr << "The cosimulation ring has " << ring->header->num_in_words << " input and " << ring->header->num_out_words
+              << " output words, expected " << num_in_words << " and " << num_out_words << "." << std::endl;
+    return false;
+  }
+  ring->slot_words = num_in_words + num_out_words;
+  __atomic_store_n(&ring->header->producer_pid, (uint32_t) getpid(), __ATOMIC_RELEASE);
+  return true;
+}
+
+static void cosim_ring_close(CosimRing *ring, const char *unlink_name)
+{
+  if(ring->header != NULL)
+    munmap(ring->header, ring->map_len);
+  if(unlink_name != NULL)
+    shm_unlink(unlink_name);
+  *ring = CosimRing();
+}
+
+/* spins briefly, then yields, then sleeps, while the other side catches up */
+static inline void cosim_ring_backoff(int *num_waits)
+{
+  if(++*num_waits < 1024)
+    return;
+  if(*num_waits < 2048) {
+    sched_yield();
+    return;
+  }
+  struct timespec pause = {0, 50 * 1000};
+  nanosleep(&pause, NULL);
+}
+
+/* returns the slot to fill for the next tick, or NULL if the consumer aborted */
+static inline uint32_t *cosim_ring_producer_slot(CosimRing *ring)
+{
+  CosimRingHeader *header = ring->header;
+  // Checked on every tick, so that the producer stops right after a divergence rather than when the ring fills up.
+  if(__atomic_load_n(&header->consumer_abort, __ATOMIC_ACQUIRE))
+    return NULL;
+  uint64_t head = header->head;
+  int num_waits = 0;
+  while(head - ring->cached_counter == header->num_slots) {
+    ring->cached_counter = __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE);
+    if(head - ring->cached_counter < header->num_slots)
+      break;
+    if(__atomic_load_n(&header->consumer_abort, __ATOMIC_ACQUIRE))
+      return NULL;
+    cosim_ring_backoff(&num_waits);
+  }
+  return ring->slots + (head & (header->num_slots - 1)) * ring->slot_words;
+}
+
+static inline void cosim_ring_producer_publish(CosimRing *ring)
+{
+  __atomic_store_n(&ring->header->head, ring->header->head + 1, __ATOMIC_RELEASE);
+}
+
+static void cosim_ring_producer_finish(CosimRing *ring)
+{
+  __atomic_store_n(&ring->header->producer_done, 1, __ATOMIC_RELEASE);
+}
+
+/* whether the producer may still publish ticks: it is running, or it has not attached yet but still has time to */
+static bool cosim_ring_producer_alive(CosimRing *ring)
+{
+  pid_t producer_pid = __atomic_load_n(&ring->header->producer_pid, __ATOMIC_ACQUIRE);
+  if(producer_pid != 0)
+    return cosim_ring_pid_alive(producer_pid);
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long waited_ms = (now.tv_sec - ring->created_at.tv_sec) * 1000 + (now.tv_nsec - ring->created_at.tv_nsec) / 1000000;
+  return waited_ms < COSIM_RING_PRODUCER_TIMEOUT_MS;
+}
+
+/*
+ * Returns the next slot to check, or NULL once the producer is done and the ring is drained.
+ * Also returns NULL, with producer_lost set, if the producer never attached or exited without finishing.
+ */
+static inline const uint32_t *cosim_ring_consumer_slot(CosimRing *ring)
+{
+  CosimRingHeader *header = ring->header;
+  uint64_t tail = header->tail;
+  int num_waits = 0;
+  while(tail == ring->cached_counter) {
+    // Read the done flag before head, so that no tick published before it is missed.
+    bool producer_done = __atomic_load_n(&header->producer_done, __ATOMIC_ACQUIRE);
+    ring->cached_counter = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    if(tail != ring->cached_counter)
+      break;
+    if(producer_done)
+      return NULL;
+    // The producer sets producer_done before exiting, so read it again once the producer is gone.
+    if(num_waits % COSIM_RING_LIVENESS_WAITS == COSIM_RING_LIVENESS_WAITS - 1 && !cosim_ring_producer_alive(ring)
+       && !__atomic_load_n(&header->producer_done, __ATOMIC_ACQUIRE)) {
+      ring->producer_lost = true;
+      return NULL;
+    }
+    cosim_ring_backoff(&num_waits);
+  }
+  return ring->slots + (tail & (header->num_slots - 1)) * ring->slot_words;
+}
+
+static inline void cosim_ring_consumer_release(CosimRing *ring)
+{
+  __atomic_store_n(&ring->header->tail, ring->header->tail + 1, __ATOMIC_RELEASE);
+}
+
+static void cosim_ring_consumer_abort(CosimRing *ring)
+{
+  __atomic_store_n(&ring->header->consumer_abort, 1, __ATOMIC_RELEASE);
+}
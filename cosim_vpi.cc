@@ -0,0 +1,169 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+// VPI side of the Icarus/Verilator co-simulation, built with iverilog-vpi and loaded with vvp -mcosim_vpi.
+// Provides the stimulus to tb_icarus.sv, built with -DCOSIM, and streams the inputs and outputs
+// of every tick into the shared-memory ring read by tb_cosim.
+//   $cosim_open(simlen)                   loads the stimulus as tb_base does and attaches to the ring
+//   $cosim_get_inputs(in_data)            drives the input vector of the next tick
+//   $cosim_put_outputs(in_data, out_data) publishes the tick, and finishes the simulation if tb_cosim gave up
+//   $cosim_close                          tells tb_cosim that no tick follows
+
+#include <vpi_user.h>
+
+#include "ticks.h"
+#include "stimulus.h"
+#include "cosim_ring.h"
+
+// This is a generated header
+#include "interface_sizes.h"
+
+#define NUM_IN_WORDS ((IN_DATA_WIDTH + 31) / 32)
+#define NUM_OUT_WORDS ((OUT_DATA_WIDTH + 31) / 32)
+#define NUM_RANDOM_INPUTS_PER_TICK (FULL_RANDOM ? NUM_IN_WORDS : 1)
+
+// Time tb_cosim has to create the ring, which it does before anything else.
+#define COSIM_ATTACH_TIMEOUT_MS 10000
+
+static Stimulus cosim_stimulus;
+static StimulusCursor *cosim_cursor = NULL;
+static CosimRing cosim_ring;
+
+/* returns the handle of the argument_id-th argument of the calling system task */
+static vpiHandle cosim_task_arg(int argument_id)
+{
+  vpiHandle call_handle = vpi_handle(vpiSysTfCall, NULL);
+  vpiHandle arg_iterator = vpi_iterate(vpiArgument, call_handle);
+  vpiHandle arg_handle = NULL;
+  for (int i = 0; i <= argument_id && arg_iterator != NULL; i++)
+    arg_handle = vpi_scan(arg_iterator);
+  if (arg_iterator != NULL && arg_handle != NULL)
+    vpi_free_object(arg_iterator);
+  return arg_handle;
+}
+
+/* reads a vector argument into words; X and Z bits read as 0, and are reported */
+static void cosim_read_vector(vpiHandle handle, uint32_t *words, int num_words)
+{
+  s_vpi_value value;
+  value.format = vpiVectorVal;
+  vpi_get_value(handle, &value);
+  for (int i = 0; i < num_words; i++) {
+    if (value.value.vector[i].bval)
+      vpi_printf("Warning: X or Z bits in %s, read as 0.\n", vpi_get_str(vpiName, handle));
+    words[i] = value.value.vector[i].aval & ~value.value.vector[i].bval;
+  }
+}
+
+static PLI_INT32 cosim_open_calltf(PLI_BYTE8 *)
+{
+  s_vpi_value value;
+  value.format = vpiIntVal;
+  vpi_get_value(cosim_task_arg(0), &value);
+  int simlen = value.value.integer;
+
+  const char *stimulus_path = cl_get_stimfile();
+  uint64_t seed;
+  bool loaded;
+  if (cl_get_stim_seed(&seed))
+    loaded = stimulus_init_generator(&cosim_stimulus, cl_get_stim_mode(FULL_RANDOM), seed, cl_get_stim_flips(), NUM_RANDOM_INPUTS_PER_TICK, simlen);
+  else if (stimulus_path == NULL)
+    loaded = stimulus_load_text(&cosim_stimulus, PATH_TO_RANDOM_INPUTS_FILE, (size_t) simlen * NUM_RANDOM_INPUTS_PER_TICK);
+  else
+    loaded = stimulus_open_binary(&cosim_stimulus, stimulus_path, cl_get_stim_streaming(), IN_DATA_WIDTH, NUM_RANDOM_INPUTS_PER_TICK, simlen);
+  if (!loaded || !cosim_ring_attach(&cosim_ring, cl_get_cosim_ring(), NUM_IN_WORDS, NUM_OUT_WORDS, COSIM_ATTACH_TIMEOUT_MS)) {
+    // A ring with other port widths is mapped but unusable, so leave both the ring and the stimulus closed.
+    cosim_ring_close(&cosim_ring, NULL);
+    stimulus_close(&cosim_stimulus);
+    vpi_control(vpiFinish, 1);
+    return 0;
+  }
+  cosim_cursor = new StimulusCursor(&cosim_stimulus, 0);
+  return 0;
+}
+
+static PLI_INT32 cosim_get_inputs_calltf(PLI_BYTE8 *)
+{
+  // After a failed $cosim_open, the testbench runs on until the finish requested there takes effect.
+  if (cosim_cursor == NULL)
+    return 0;
+  uint32_t in_words[NUM_IN_WORDS];
+  stimulus_next_input_vector(*cosim_cursor, in_words, NUM_IN_WORDS, FULL_RANDOM);
+  s_vpi_vecval in_vector[NUM_IN_WORDS];
+  for (int i = 0; i < NUM_IN_WORDS; i++) {
+    in_vector[i].aval = in_words[i];
+    in_vector[i].bval = 0;
+  }
+  s_vpi_value value;
+  value.format = vpiVectorVal;
+  value.value.vector = in_vector;
+  vpi_put_value(cosim_task_arg(0), &value, NULL, vpiNoDelay);
+  return 0;
+}
+
+static PLI_INT32 cosim_put_outputs_calltf(PLI_BYTE8 *)
+{
+  if (cosim_ring.header == NULL)
+    return 0;
+  uint32_t *slot = cosim_ring_producer_slot(&cosim_ring);
+  if (slot == NULL) {
+    vpi_printf("tb_cosim reported a divergence, stopping.\n");
+    vpi_control(vpiFinish, 1);
+    return 0;
+  }
+  cosim_read_vector(cosim_task_arg(0), slot, NUM_IN_WORDS);
+  cosim_read_vector(cosim_task_arg(1), slot + NUM_IN_WORDS, NUM_OUT_WORDS);
+  cosim_ring_producer_publish(&cosim_ring);
+  return 0;
+}
+
+static void cosim_close(void)
+{
+  if (cosim_ring.header == NULL)
+    return;
+  cosim_ring_producer_finish(&cosim_ring);
+  cosim_ring_close(&cosim_ring, NULL);
+  delete cosim_cursor;
+  cosim_cursor = NULL;
+  stimulus_close(&cosim_stimulus);
+}
+
+static PLI_INT32 cosim_close_calltf(PLI_BYTE8 *)
+{
+  cosim_close();
+  return 0;
+}
+
+static PLI_INT32 cosim_end_of_simulation(p_cb_data)
+{
+  // Also release tb_cosim if the testbench finished without $cosim_close.
+  cosim_close();
+  return 0;
+}
+
+static void cosim_register_task(const char *name, PLI_INT32 (*calltf)(PLI_BYTE8 *))
+{
+  s_vpi_systf_data task_data;
+  memset(&task_data, 0, sizeof(task_data));
+  task_data.type = vpiSysTask;
+  task_data.tfname = (PLI_BYTE8 *) name;
+  task_data.calltf = calltf;
+  vpi_register_systf(&task_data);
+}
+
+static void cosim_register(void)
+{
+  cosim_register_task("$cosim_open", cosim_open_calltf);
+  cosim_register_task("$cosim_get_inputs", cosim_get_inputs_calltf);
+  cosim_register_task("$cosim_put_outputs", cosim_put_outputs_calltf);
+  cosim_register_task("$cosim_close", cosim_close_calltf);
+
+  s_cb_data end_data;
+  memset(&end_data, 0, sizeof(end_data));
+  end_data.reason = cbEndOfSimulation;
+  end_data.cb_rtn = cosim_end_of_simulation;
+  vpi_register_cb(&end_data);
+}
+
+void (*vlog_startup_routines[])(void) = {cosim_register, 0};
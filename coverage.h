@@ -0,0 +1,151 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* toggle coverage of the outputs and of selected internal signals, exported as a file or as an AFL map */
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/shm.h>
+
+/*
+ * The sampled signals are packed, byte-aligned, into a state vector of 64-bit words. After each eval(),
+ * the new state is XORed with the previous one, and the changed bits are ORed into the rise (0 -> 1)
+ * and fall (1 -> 0) bitmaps. Bit b of the state, and of both bitmaps, is bit b % 8 of byte b / 8.
+ *
+ * Coverage file format (little endian): CoverageFileHeader, then the rise bitmap and the fall bitmap,
+ * of num_state_bits / 8 bytes each.
+ */
+#define COVERAGE_FILE_MAGIC "TBCOVER1"
+
+// Size of the AFL map when AFL_MAP_SIZE is unset, as in AFL.
+#define COVERAGE_AFL_DEFAULT_MAP_SIZE (1 << 16)
+
+struct CoverageFileHeader {
+  char magic[8];
+  uint32_t num_state_bits;
+  uint32_t num_signals;
+};
+
+struct CoverageSignal {
+  std::string name;
+  const void *data;
+  int num_bytes;
+  // Byte offset of the signal in the state.
+  int offset;
+};
+
+struct ToggleCoverage {
+  std::vector<CoverageSignal> signals;
+  int num_state_bytes = 0;
+  std::vector<uint64_t> curr_state;
+  std::vector<uint64_t> prev_state;
+  std::vector<uint64_t> rise;
+  std::vector<uint64_t> fall;
+  // Whether prev_state holds a sample yet.
+  bool primed = false;
+};
+
+/* adds a signal of the model to sample, given its Verilator storage */
+static void coverage_add_signal(ToggleCoverage &coverage, const std::string &name, const void *data, int num_bytes)
+{
+  coverage.signals.push_back({name, data, num_bytes, coverage.num_state_bytes});
+  coverage.num_state_bytes += num_bytes;
+  size_t num_state_words = (coverage.num_state_bytes + 7) / 8;
+  coverage.curr_state.resize(num_state_words, 0);
+  coverage.prev_state.resize(num_state_words, 0);
+  coverage.rise.resize(num_state_words, 0);
+  coverage.fall.resize(num_state_words, 0);
+}
+
+/* samples the signals after an eval(); the first sample only primes the previous state */
+static inline void coverage_sample(ToggleCoverage &coverage)
+{
+  uint8_t *curr_bytes = (uint8_t *) coverage.curr_state.data();
+  for (const CoverageSignal &signal : coverage.signals)
+    memcpy(curr_bytes + signal.offset, signal.data, signal.num_bytes);
+
+  if (coverage.primed) {
+    const uint64_t *curr = coverage.curr_state.data();
+    const uint64_t *prev = coverage.prev_state.data();
+    uint64_t *rise = coverage.rise.data();
+    uint64_t *fall = coverage.fall.data();
+    size_t num_state_words = coverage.curr_state.size();
+    // Independent iterations over plain words, which the compiler vectorizes.
+    for (size_t i = 0; i < num_state_words; i++) {
+      uint64_t changed = curr[i] ^ prev[i];
+      rise[i] |= changed & curr[i];
+      fall[i] |= changed & prev[i];
+    }
+  }
+  // The whole state is rewritten by the next sample, so swapping is enough.
+  coverage.curr_state.swap(coverage.prev_state);
+  coverage.primed = true;
+}
+
+/* merges the bitmaps of coverage with the same signals, for example from another shard */
+static void coverage_merge(ToggleCoverage &into, const ToggleCoverage &from)
+{
+  for (size_t i = 0; i < into.rise.size(); i++) {
+    into.rise[i] |= from.rise[i];
+    into.fall[i] |= from.fall[i];
+  }
+}
+
+/* number of covered toggles, counting rises and falls separately */
+static uint64_t coverage_count(const ToggleCoverage &coverage)
+{
+  uint64_t count = 0;
+  for (size_t i = 0; i < coverage.rise.size(); i++)
+    count += __builtin_popcountll(coverage.rise[i]) + __builtin_popcountll(coverage.fall[i]);
+  return count;
+}
+
+static bool coverage_write_file(const ToggleCoverage &coverage, const char *path)
+{
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) { std::cerr << "Could not write coverage file " << path << "." << std::endl; return false; }
+  CoverageFileHeader header;
+  memcpy(header.magic, COVERAGE_FILE_MAGIC, sizeof(header.magic));
+  header.num_state_bits = coverage.num_state_bytes * 8;
+  header.num_signals = coverage.signals.size();
+  bool written = fwrite(&header, sizeof(header), 1, f) == 1
+              && fwrite(coverage.rise.data(), 1, coverage.num_state_bytes, f) == (size_t) coverage.num_state_bytes
+              && fwrite(coverage.fall.data(), 1, coverage.num_state_bytes, f) == (size_t) coverage.num_state_bytes;
+  fclose(f);
+  if (!written) { std::cerr << "Could not write coverage file " << path << "." << std::endl; return false; }
+  return true;
+}
+
+/*
+ * Marks the covered toggles in the AFL shared-memory map of map_size entries: rise bit b sets entry b,
+ * and fall bit b sets entry num_state_bits + b, both modulo the map size.
+ */
+static bool coverage_export_afl(const ToggleCoverage &coverage, int shm_id, uint64_t map_size)
+{
+  // A map smaller than AFL_MAP_SIZE would be written past its end.
+  struct shmid_ds shm_stat;
+  if (shmctl(shm_id, IPC_STAT, &shm_stat) < 0) { std::cerr << "Could not query the AFL map " << shm_id << "." << std::endl; return false; }
+  if (shm_stat.shm_segsz < map_size) {
+    std::cerr << "The AFL map " << shm_id << " has " << shm_stat.shm_segsz << " bytes, fewer than the " << map_size << " entries of AFL_MAP_SIZE." << std::endl;
+    return false;
+  }
+  uint8_t *afl_map = (uint8_t *) shmat(shm_id, NULL, 0);
+  if (afl_map == (uint8_t *) -1) { std::cerr << "Could not attach the AFL map " << shm_id << "." << std::endl; return false; }
+  uint64_t num_state_bits = coverage.num_state_bytes * 8;
+  for (size_t i = 0; i < coverage.rise.size(); i++) {
+    for (uint64_t bits = coverage.rise[i]; bits; bits &= bits - 1)
+      afl_map[(64 * i + __builtin_ctzll(bits)) % map_size] = 1;
+    for (uint64_t bits = coverage.fall[i]; bits; bits &= bits - 1)
+      afl_map[(num_state_bits + 64 * i + __builtin_ctzll(bits)) % map_size] = 1;
+  }
+  shmdt(afl_map);
+  return true;
+}
@@ -0,0 +1,104 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Decodes a probe file written by the harness with PROBES (see probes.h), as text or as a VCD.
+# The text has one line per tick and signal, "<tick> <signal> <hexadecimal value>", and the VCD
+# only holds the value changes, one time unit per tick.
+# Usage: python3 decode_probes.py probes.bin [--vcd probes.vcd] [--signals 'signal0*'] [--changes]
+
+import argparse
+import fnmatch
+import struct
+import sys
+
+PROBE_FILE_MAGIC = b'TBPROBE1'
+PROBE_FILE_HEADER_FORMAT = '<8sIIQQ'
+PROBE_FILE_SIGNAL_FORMAT = '<III'
+
+def read_probes(path: str):
+    # Returns the first tick, the signals as (name, width) and one list of values per tick.
+    with open(path, 'rb') as f:
+        content = f.read()
+    magic, num_signals, record_bytes, first_tick, num_ticks = struct.unpack_from(PROBE_FILE_HEADER_FORMAT, content, 0)
+    if magic != PROBE_FILE_MAGIC:
+        raise ValueError(f"{path} is not a probe file.")
+    offset = struct.calcsize(PROBE_FILE_HEADER_FORMAT)
+    signals = []
+    for _ in range(num_signals):
+        width, num_bytes, name_len = struct.unpack_from(PROBE_FILE_SIGNAL_FORMAT, content, offset)
+        offset += struct.calcsize(PROBE_FILE_SIGNAL_FORMAT)
+        signals.append((content[offset:offset + name_len].decode('ascii'), width, num_bytes))
+        offset += name_len
+
+    ticks = []
+    for tick_id in range(num_ticks):
+        record_offset = offset + tick_id * record_bytes
+        if record_offset + record_bytes > len(content):
+            print(f"Warning: {path} is truncated after {tick_id} of {num_ticks} ticks.", file=sys.stderr)
+            break
+        values = []
+        for _, width, num_bytes in signals:
+            value = int.from_bytes(content[record_offset:record_offset + num_bytes], 'little')
+            values.append(value & ((1 << width) - 1))
+            record_offset += num_bytes
+        ticks.append(values)
+    return first_tick, [(name, width) for name, width, _ in signals], ticks
+
+def vcd_identifier(signal_id: int):
+    identifier = ''
+    signal_id += 1
+    while signal_id > 0:
+        signal_id -= 1
+        identifier += chr(33 + signal_id % 94)
+        signal_id //= 94
+    return identifier
+
+def write_vcd(f, first_tick: int, signals, ticks):
+    f.write("$timescale 1ns $end\n$scope module top $end\n")
+    for signal_id, (name, width) in enumerate(signals):
+        f.write(f"$var wire {width} {vcd_identifier(signal_id)} {name} $end\n")
+    f.write("$upscope $end\n$enddefinitions $end\n")
+    prev_values = [None] * len(signals)
+    for tick_id, values in enumerate(ticks):
+        changes = [(signal_id, value) for signal_id, value in enumerate(values) if value != prev_values[signal_id]]
+        if not changes:
+            continue
+        f.write(f"#{first_tick + tick_id}\n")
+        for signal_id, value in changes:
+            if signals[signal_id][1] == 1:
+                f.write(f"{value}{vcd_identifier(signal_id)}\n")
+            else:
+                f.write(f"b{value:b} {vcd_identifier(signal_id)}\n")
+        prev_values = values
+
+def write_text(f, first_tick: int, signals, ticks, changes_only: bool):
+    prev_values = [None] * len(signals)
+    for tick_id, values in enumerate(ticks):
+        for signal_id, value in enumerate(values):
+            if changes_only and value == prev_values[signal_id]:
+                continue
+            name, width = signals[signal_id]
+            f.write(f"{first_tick + tick_id} {name} {value:0{(width + 3) // 4}x}\n")
+        prev_values = values
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('probe_path')
+    parser.add_argument('--vcd', help='Write a VCD to this path instead of text to the standard output.')
+    parser.add_argument('--signals', default='*', help='Comma-separated glob patterns of the signals to decode.')
+    parser.add_argument('--changes', action='store_true', help='Only print the values that changed since the previous tick.')
+    args = parser.parse_args()
+
+    first_tick, signals, ticks = read_probes(args.probe_path)
+    patterns = args.signals.split(',')
+    kept_ids = [signal_id for signal_id, (name, _) in enumerate(signals) if any(fnmatch.fnmatchcase(name, pattern) for pattern in patterns)]
+    signals = [signals[signal_id] for signal_id in kept_ids]
+    ticks = [[values[signal_id] for signal_id in kept_ids] for values in ticks]
+
+    if args.vcd:
+        with open(args.vcd, 'w') as f:
+            write_vcd(f, first_tick, signals, ticks)
+        print(f"Wrote {len(ticks)} ticks of {len(signals)} signals to {args.vcd}.")
+    else:
+        write_text(sys.stdout, first_tick, signals, ticks, args.changes)
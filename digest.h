@@ -0,0 +1,172 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* per-tick CRC32C digests of the outputs and their binary log, compared by compare_digests.py */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#endif
+
+/*
+ * The digest of a tick is the raw CRC32C (reflected polynomial 0x82F63B78, no final inversion)
+ * of its output words, starting from DIGEST_SEED. The output digest of a run chains the per-tick
+ * digests in the same way, so it also equals the raw CRC32C of the body of the digest log.
+ *
+ * Digest log format (little endian): DigestLogHeader, then one 32-bit digest per tick.
+ */
+#define DIGEST_SEED 0xffffffffu
+#define DIGEST_LOG_MAGIC "TBDIGST1"
+
+struct DigestLogHeader {
+  char magic[8];
+  uint32_t out_data_width;
+  uint32_t reserved;
+  uint64_t num_ticks;
+};
+static_assert(sizeof(DigestLogHeader) == 24, "The digest log header must stay packed.");
+
+static uint32_t crc32c_byte_table[256];
+
+static bool crc32c_init_table(void)
+{
+  for (uint32_t byte = 0; byte < 256; byte++) {
+    uint32_t crc = byte;
+    for (int bit_id = 0; bit_id < 8; bit_id++)
+      crc = (crc >> 1) ^ (0x82f63b78u & (0u - (crc & 1)));
+    crc32c_byte_table[byte] = crc;
+  }
+  return true;
+}
+static const bool crc32c_table_ready = crc32c_init_table();
+
+static inline uint32_t crc32c_u32_table(uint32_t crc, uint32_t word)
+{
+  crc ^= word;
+  for (int byte_id = 0; byte_id < 4; byte_id++)
+    crc = (crc >> 8) ^ crc32c_byte_table[crc & 0xff];
+  return crc;
+}
+
+/*
+ * The builds do not pass -msse4.2, so on x86 the CRC32 instruction is compiled for its own functions and
+ * picked at run time if the CPU has it. Building with -msse4.2 uses it unconditionally.
+ */
+#if defined(__SSE4_2__)
+#define CRC32C_HW_DISPATCH 0
+static const bool crc32c_has_hw = true;
+#elif defined(__x86_64__) || defined(__i386__)
+#define CRC32C_HW_DISPATCH 1
+static bool crc32c_detect_hw(void)
+{
+  // Static initializers may run before the one of the CPU model.
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.2");
+}
+static const bool crc32c_has_hw = crc32c_detect_hw();
+#else
+#define CRC32C_HW_DISPATCH 0
+static const bool crc32c_has_hw = false;
+#endif
+
+#if defined(__SSE4_2__) || CRC32C_HW_DISPATCH
+#if CRC32C_HW_DISPATCH
+__attribute__((target("sse4.2")))
+#endif
+static inline uint32_t crc32c_words_hw(uint32_t crc, const uint32_t *words, int num_words)
+{
+  for (int i = 0; i < num_words; i++)
+    crc = _mm_crc32_u32(crc, words[i]);
+  return crc;
+}
+#endif
+
+static inline uint32_t crc32c_words(uint32_t crc, const uint32_t *words, int num_words)
+{
+#if defined(__SSE4_2__) || CRC32C_HW_DISPATCH
+  if (crc32c_has_hw)
+    return crc32c_words_hw(crc, words, num_words);
+#endif
+  for (int i = 0; i < num_words; i++)
+    crc = crc32c_u32_table(crc, words[i]);
+  return crc;
+}
+
+static inline uint32_t crc32c_u32(uint32_t crc, uint32_t word)
+{
+  return crc32c_words(crc, &word, 1);
+}
+
+// Number of digests buffered by a DigestWriter between two writes.
+#define DIGEST_WRITER_BUFFER_TICKS 4096
+
+/* writes the digests of a contiguous range of ticks, and chains them */
+struct DigestWriter {
+  int fd;
+  uint64_t next_tick;
+  // Raw CRC32C of this range's digests, starting from initial_chain. Ranges started from 0 can be
+  // combined with digest_chain_append, and a range started from DIGEST_SEED at tick 0 holds the output digest.
+  uint32_t chain;
+  uint64_t num_ticks;
+  uint32_t buffer[DIGEST_WRITER_BUFFER_TICKS];
+  int num_buffered;
+
+  DigestWriter(int fd, uint64_t first_tick, uint32_t initial_chain = 0) : fd(fd), next_tick(first_tick), chain(initial_chain), num_ticks(0), num_buffered(0) {}
+};
+
+/* creates the digest log for num_ticks ticks; returns -1 on error */
+static int digest_log_create(const char *path, uint32_t out_data_width, uint64_t num_ticks)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) { std::cerr << "Could not create digest log " << path << "." << std::endl; return -1; }
+  DigestLogHeader header;
+  memcpy(header.magic, DIGEST_LOG_MAGIC, sizeof(header.magic));
+  header.out_data_width = out_data_width;
+  header.reserved = 0;
+  header.num_ticks = num_ticks;
+  if(write(fd, &header, sizeof(header)) != sizeof(header)) { std::cerr << "Could not write digest log " << path << "." << std::endl; close(fd); return -1; }
+  return fd;
+}
+
+static void digest_writer_flush(DigestWriter &writer)
+{
+  if(writer.fd < 0 || writer.num_buffered == 0)
+    return;
+  size_t num_bytes = writer.num_buffered * sizeof(uint32_t);
+  off_t offset = sizeof(DigestLogHeader) + (writer.next_tick - writer.num_buffered) * sizeof(uint32_t);
+  if(pwrite(writer.fd, writer.buffer, num_bytes, offset) != (ssize_t) num_bytes) {
+    std::cerr << "Could not write the digest log." << std::endl; exit(1);
+  }
+  writer.num_buffered = 0;
+}
+
+/* digests the outputs of the next tick */
+static inline void digest_writer_push(DigestWriter &writer, const uint32_t *out_words, int num_out_words)
+{
+  uint32_t digest = crc32c_words(DIGEST_SEED, out_words, num_out_words);
+  writer.chain = crc32c_u32(writer.chain, digest);
+  writer.num_ticks++;
+  writer.next_tick++;
+  if(writer.fd < 0)
+    return;
+  writer.buffer[writer.num_buffered++] = digest;
+  if(writer.num_buffered == DIGEST_WRITER_BUFFER_TICKS)
+    digest_writer_flush(writer);
+}
+
+/* appends the chain of a later range of ticks to the chain of the ticks before it */
+static uint32_t digest_chain_append(uint32_t chain, const DigestWriter &range)
+{
+  // The raw CRC is linear: crc(A || B) = crc(crc(A), zeros(|B|)) ^ crc(0, B).
+  for (uint64_t tick_id = 0; tick_id < range.num_ticks; tick_id++)
+    chain = crc32c_u32(chain, 0);
+  return chain ^ range.chain;
+}
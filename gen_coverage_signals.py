@@ -0,0 +1,42 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Lists the internal signals of top.sv sampled for toggle coverage into coverage_signals.h.
+# The design must then be verilated with --public-flat-rw so that the signals stay accessible.
+# Usage: python3 gen_coverage_signals.py [top.sv] [coverage_signals.h] [--signals 'signal0*,signal1[0-4]*']
+
+import argparse
+import fnmatch
+import re
+
+SIGNAL_DECL_RE = re.compile(r'^\s*bit\s*(?:\[(\d+):(\d+)\])?\s*(\w+)\s*;')
+
+def parse_internal_signals(sv_path: str):
+    signals = []
+    with open(sv_path, 'r') as f:
+        for line in f:
+            match = SIGNAL_DECL_RE.match(line)
+            if match and match.group(3) not in ('in_data', 'out_data'):
+                width = int(match.group(1)) - int(match.group(2)) + 1 if match.group(1) else 1
+                signals.append((match.group(3), width))
+    return signals
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('sv_path', nargs='?', default='top.sv')
+    parser.add_argument('header_path', nargs='?', default='coverage_signals.h')
+    parser.add_argument('--signals', default='*', help='Comma-separated glob patterns of the signals to sample.')
+    args = parser.parse_args()
+
+    patterns = args.signals.split(',')
+    signals = [(name, width) for name, width in parse_internal_signals(args.sv_path) if any(fnmatch.fnmatchcase(name, pattern) for pattern in patterns)]
+
+    with open(args.header_path, 'w') as f:
+        f.write("// Generated by gen_coverage_signals.py\n")
+        f.write("#pragma once\n")
+        f.write("#define COVERAGE_SIGNALS(X)")
+        for name, width in signals:
+            f.write(f" \\\n  X({name})")
+        f.write("\n")
+    print(f"Wrote {len(signals)} signals ({sum(width for _, width in signals)} bits) to {args.header_path}.")
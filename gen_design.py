@@ -0,0 +1,136 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Generates a random combinational netlist in the style of top.sv, together with its interface_sizes.h.
+# Usage: python3 gen_design.py <out_dir> [--in-width 288] [--out-width 160] [--num-signals 186] [--depth 8]
+#                              [--max-width 300] [--op-mix div=1,mod=1,pow=1,shift=2,red=1,eq=1,concat=3] [--seed 0]
+
+import argparse
+import os
+import random
+
+# Operator classes used by top.sv, and their default relative weights.
+DEFAULT_OP_MIX = {'div': 1, 'mod': 1, 'pow': 1, 'shift': 2, 'red': 1, 'eq': 1, 'concat': 3}
+
+def parse_op_mix(op_mix_str: str):
+    op_mix = dict.fromkeys(DEFAULT_OP_MIX, 0)
+    for entry in op_mix_str.split(','):
+        op_name, weight = entry.split('=')
+        if op_name not in op_mix:
+            raise ValueError(f"Unknown operator class {op_name}, expected one of {', '.join(DEFAULT_OP_MIX)}.")
+        op_mix[op_name] = int(weight)
+    return op_mix
+
+class DesignGenerator:
+    def __init__(self, in_width: int, out_width: int, num_signals: int, depth: int, max_width: int, op_mix: dict, seed: int):
+        self.rng = random.Random(seed)
+        self.in_width = in_width
+        self.out_width = out_width
+        self.depth = depth
+        self.op_mix = op_mix
+        # Each signal has a width and a level. Operands of a level-l signal are in_data or signals of lower levels,
+        # so the netlist is acyclic and its logic depth is bounded by depth.
+        self.signals = []
+        for signal_id in range(num_signals):
+            level = 1 + signal_id * depth // num_signals
+            self.signals.append((f"signal{signal_id:03d}_", self.rng.randint(1, max_width), level))
+        # Signals read by other signals. The others feed the outputs, so that no logic is dead.
+        self.used_signals = set()
+
+    # Returns a random slice of in_data or of a signal of a level below the given one, as (expression, width).
+    def operand(self, level: int, max_width: int):
+        candidates = [(name, width) for name, width, signal_level in self.signals if signal_level < level]
+        if not candidates or self.rng.random() < 0.2:
+            name, width = 'in_data', self.in_width
+        else:
+            name, width = self.rng.choice(candidates)
+            self.used_signals.add(name)
+        slice_width = self.rng.randint(1, min(width, max_width))
+        lsb = self.rng.randint(0, width - slice_width)
+        if slice_width == width:
+            return name, width
+        if slice_width == 1:
+            return f"{name}[{lsb}]", 1
+        return f"{name}[{lsb + slice_width - 1}:{lsb}]", slice_width
+
+    def concat(self, level: int, width: int):
+        parts, remaining = [], width
+        while remaining > 0:
+            expr, part_width = self.operand(level, remaining)
+            parts.append(expr)
+            remaining -= part_width
+        return '{ ' + ', '.join(parts) + ' }'
+
+    def expression(self, level: int, width: int):
+        op_name = self.rng.choices(list(self.op_mix), weights=list(self.op_mix.values()))[0]
+        if op_name == 'concat':
+            return f"{self.concat(level, width)} + {self.concat(level, width)}"
+        if op_name in ('div', 'mod'):
+            # As in top.sv, the divisor has its top bit set so that it is never zero.
+            divisor = self.concat(level, width - 1) if width > 1 else None
+            divisor = f"{{ 1'h1, {divisor[2:-2]} }}" if divisor else "1'h1"
+            return f"{self.concat(level, width)} {'/' if op_name == 'div' else '%'} {divisor}"
+        if op_name == 'pow':
+            exponent, _ = self.operand(level, 3)
+            return f"{self.concat(level, width)} ** {exponent}"
+        if op_name == 'shift':
+            amount, _ = self.operand(level, 6)
+            return f"{self.concat(level, width)} {self.rng.choice(['<<<', '>>>'])} {amount}"
+        if op_name == 'red':
+            reduction = self.rng.choice(['&', '|', '^'])
+            return f"{self.concat(level, width)} ^ {{ {width}{{ {reduction} {self.concat(level, self.rng.randint(2, 64))} }} }}"
+        if op_name == 'eq':
+            comparand_width = self.rng.randint(2, 128)
+            return f"{self.concat(level, width)} ^ {{ {width}{{ {self.concat(level, comparand_width)} === {self.concat(level, comparand_width)} }} }}"
+        raise ValueError(op_name)
+
+    def generate(self):
+        lines = ["module top(in_data, out_data);"]
+        lines.append(f"  input [{self.in_width - 1}:0] in_data;")
+        lines.append(f"  bit [{self.in_width - 1}:0] in_data;")
+        lines.append(f"  output [{self.out_width - 1}:0] out_data;")
+        lines.append(f"  bit [{self.out_width - 1}:0] out_data;")
+        for name, width, _ in self.signals:
+            lines.append(f"  bit [{width - 1}:0] {name};" if width > 1 else f"  bit {name};")
+        for name, width, level in self.signals:
+            lines.append(f"  assign {name} = {self.expression(level, width)};")
+        # The outputs fold all the signals that no other signal reads.
+        sinks = [(name, width) for name, width, _ in self.signals if name not in self.used_signals]
+        sinks_width = sum(width for _, width in sinks)
+        lines.insert(5 + len(self.signals), f"  bit [{sinks_width - 1}:0] sinks_;")
+        lines.append(f"  assign sinks_ = {{ {', '.join(name for name, _ in sinks)} }};")
+        chunks = []
+        for chunk_lsb in range(0, sinks_width, self.out_width):
+            chunk_msb = min(chunk_lsb + self.out_width, sinks_width) - 1
+            chunks.append(f"sinks_[{chunk_msb}:{chunk_lsb}]")
+        lines.append(f"  assign out_data = {' ^ '.join(chunks)};")
+        lines.append("endmodule")
+        return '\n'.join(lines) + '\n'
+
+def write_interface_sizes(path: str, in_width: int, out_width: int, inputs_path: str):
+    with open(path, 'w') as f:
+        f.write("#pragma once\n")
+        f.write(f"#define IN_DATA_WIDTH  {in_width}\n")
+        f.write("#define FULL_RANDOM  1\n")
+        f.write(f"#define OUT_DATA_WIDTH {out_width}\n")
+        f.write(f"#define PATH_TO_RANDOM_INPUTS_FILE \"{inputs_path}\"\n")
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('out_dir')
+    parser.add_argument('--in-width', type=int, default=288)
+    parser.add_argument('--out-width', type=int, default=160)
+    parser.add_argument('--num-signals', type=int, default=186)
+    parser.add_argument('--depth', type=int, default=8)
+    parser.add_argument('--max-width', type=int, default=300)
+    parser.add_argument('--op-mix', default=','.join(f"{op_name}={weight}" for op_name, weight in DEFAULT_OP_MIX.items()))
+    parser.add_argument('--seed', type=int, default=0)
+    args = parser.parse_args()
+
+    os.makedirs(args.out_dir, exist_ok=True)
+    generator = DesignGenerator(args.in_width, args.out_width, args.num_signals, args.depth, args.max_width, parse_op_mix(args.op_mix), args.seed)
+    with open(os.path.join(args.out_dir, 'top.sv'), 'w') as f:
+        f.write(generator.generate())
+    write_interface_sizes(os.path.join(args.out_dir, 'interface_sizes.h'), args.in_width, args.out_width,
+                          os.path.abspath(os.path.join(args.out_dir, 'random_inputs.txt')))
@@ -0,0 +1,31 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Lists the internal signals of top.sv that can be probed at runtime with PROBES into probe_table.h.
+# The design must then be verilated with --public-flat-rw so that the signals stay accessible.
+# Usage: python3 gen_probe_table.py [top.sv] [probe_table.h] [--signals 'signal0*,signal1[0-4]*']
+
+import argparse
+import fnmatch
+
+from gen_coverage_signals import parse_internal_signals
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('sv_path', nargs='?', default='top.sv')
+    parser.add_argument('header_path', nargs='?', default='probe_table.h')
+    parser.add_argument('--signals', default='*', help='Comma-separated glob patterns of the signals that can be probed.')
+    args = parser.parse_args()
+
+    patterns = args.signals.split(',')
+    signals = [(name, width) for name, width in parse_internal_signals(args.sv_path) if any(fnmatch.fnmatchcase(name, pattern) for pattern in patterns)]
+
+    with open(args.header_path, 'w') as f:
+        f.write("// Generated by gen_probe_table.py\n")
+        f.write("#pragma once\n")
+        f.write("#define PROBE_SIGNALS(X)")
+        for name, width in signals:
+            f.write(f" \\\n  X({name}, {width})")
+        f.write("\n")
+    print(f"Wrote {len(signals)} signals ({sum(width for _, width in signals)} bits) to {args.header_path}.")
@@ -0,0 +1,173 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* per-tick input packing and output reduction, specialized at compile time on the port widths */
+#pragma once
+
+#include "verilated.h"
+#include "stimulus.h"
+#include "digest.h"
+#include "memo.h"
+
+#include <cstdint>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Ports are handled as little-endian arrays of 32-bit words, whatever their Verilator storage:
+ * CData, SData, IData or QData up to 64 bits, and VlWide<(Width + 31) / 32> above.
+ * All the loops over the words are unrolled from index sequences, and the top word of an input
+ * is masked to the port width, as Verilator expects the bits above the width of a port to be zero.
+ */
+template <int Width>
+struct Port {
+  static_assert(Width > 0, "Ports must have at least one bit.");
+  static constexpr int kNumWords = (Width + 31) / 32;
+  static constexpr uint32_t kTopWordMask = Width % 32 == 0 ? 0xffffffffu : (1u << (Width % 32)) - 1;
+  static constexpr uint64_t kMask = Width >= 64 ? ~0ull : (1ull << Width) - 1;
+  typedef typename std::conditional<Width <= 8, CData,
+          typename std::conditional<Width <= 16, SData,
+          typename std::conditional<Width <= 32, IData,
+          typename std::conditional<Width <= 64, QData, VlWide<kNumWords>>::type>::type>::type>::type type;
+};
+
+// Verilator declares the ports as references to their storage.
+template <typename PortRefT>
+using port_storage_t = typename std::remove_cv<typename std::remove_reference<PortRefT>::type>::type;
+
+/* writes words into a wide port */
+template <int Width, std::size_t... I>
+static inline void port_store_words(VlWide<Port<Width>::kNumWords> &port, const uint32_t *words, std::index_sequence<I...>)
+{
+  (void) std::initializer_list<int>{(port[I] = words[I] & (I + 1 == sizeof...(I) ? Port<Width>::kTopWordMask : 0xffffffffu), 0)...};
+}
+
+template <int Width>
+static inline void port_store(VlWide<Port<Width>::kNumWords> &port, const uint32_t *words)
+{
+  port_store_words<Width>(port, words, std::make_index_sequence<Port<Width>::kNumWords>());
+}
+
+/* writes words into a scalar port */
+template <int Width, typename ScalarT, typename std::enable_if<std::is_integral<ScalarT>::value, int>::type = 0>
+static inline void port_store(ScalarT &port, const uint32_t *words)
+{
+  static_assert(Width <= 64, "Scalar ports hold at most 64 bits.");
+  uint64_t value = words[0];
+  if (Port<Width>::kNumWords == 2)
+    value |= (uint64_t) words[Port<Width>::kNumWords - 1] << 32;
+  port = (ScalarT) (value & Port<Width>::kMask);
+}
+
+template <int Width, std::size_t... I>
+static inline void port_load_words(const VlWide<Port<Width>::kNumWords> &port, uint32_t *words, std::index_sequence<I...>)
+{
+  (void) std::initializer_list<int>{(words[I] = port[I], 0)...};
+}
+
+/* reads a wide port into words */
+template <int Width>
+static inline void port_load(const VlWide<Port<Width>::kNumWords> &port, uint32_t *words)
+{
+  port_load_words<Width>(port, words, std::make_index_sequence<Port<Width>::kNumWords>());
+}
+
+/* reads a scalar port into words */
+template <int Width, typename ScalarT, typename std::enable_if<std::is_integral<ScalarT>::value, int>::type = 0>
+static inline void port_load(const ScalarT &port, uint32_t *words)
+{
+  static_assert(Width <= 64, "Scalar ports hold at most 64 bits.");
+  words[0] = (uint32_t) port;
+  if (Port<Width>::kNumWords == 2)
+    words[Port<Width>::kNumWords - 1] = (uint32_t) ((uint64_t) port >> 32);
+}
+
+template <std::size_t... I>
+static inline uint64_t words_sum(const uint32_t *words, std::index_sequence<I...>)
+{
+  uint64_t sum = 0;
+  (void) std::initializer_list<int>{(sum += words[I], 0)...};
+  return sum;
+}
+
+/*
+ * Harness of a model with an InWidth-bit in_data port and an OutWidth-bit out_data port.
+ * With FullRandom, every tick consumes InWidth / 32 stimulus words (rounded up), and one otherwise.
+ */
+template <typename ModelT, int InWidth, int OutWidth, bool FullRandom>
+struct Harness {
+  typedef Port<InWidth> InPort;
+  typedef Port<OutWidth> OutPort;
+  static constexpr int kNumInWords = InPort::kNumWords;
+  static constexpr int kNumOutWords = OutPort::kNumWords;
+  static constexpr int kNumRandomInputsPerTick = FullRandom ? kNumInWords : 1;
+
+  static_assert(std::is_same<port_storage_t<decltype(ModelT::in_data)>, typename InPort::type>::value,
+                "The in_data port of the model does not have the width of the harness.");
+  static_assert(std::is_same<port_storage_t<decltype(ModelT::out_data)>, typename OutPort::type>::value,
+                "The out_data port of the model does not have the width of the harness.");
+
+  /* drives the inputs of the next tick of the stimulus */
+  static inline void randomize_inputs(ModelT *my_module, StimulusCursor &cursor) {
+    uint32_t in_words[kNumInWords];
+    stimulus_next_input_vector(cursor, in_words, kNumInWords, FullRandom);
+    port_store<InWidth>(my_module->in_data, in_words);
+  }
+
+  static inline void set_inputs(ModelT *my_module, const uint32_t *in_words) {
+    port_store<InWidth>(my_module->in_data, in_words);
+  }
+
+  static inline void get_inputs(const ModelT *my_module, uint32_t *in_words) {
+    port_load<InWidth>(my_module->in_data, in_words);
+  }
+
+  static inline void get_outputs(const ModelT *my_module, uint32_t *out_words) {
+    port_load<OutWidth>(my_module->out_data, out_words);
+  }
+
+  static inline void set_outputs(ModelT *my_module, const uint32_t *out_words) {
+    port_store<OutWidth>(my_module->out_data, out_words);
+  }
+
+  static inline void reset_inputs(ModelT *my_module) {
+    uint32_t in_words[kNumInWords] = {};
+    port_store<InWidth>(my_module->in_data, in_words);
+  }
+
+  /*
+   * evaluates the model, or only drives out_data with the memoized outputs of the same inputs,
+   * in which case the internal signals keep the values of the last eval()
+   */
+  static inline void eval_memoized(ModelT *my_module, MemoTable *memo) {
+    if (memo == NULL) {
+      my_module->eval();
+      return;
+    }
+    uint32_t in_words[kNumInWords];
+    get_inputs(my_module, in_words);
+    uint64_t hash = memo_hash(in_words, kNumInWords);
+    const uint32_t *memo_out_words = memo_lookup(*memo, in_words, hash);
+    if (memo_out_words != NULL && !memo->verify) {
+      set_outputs(my_module, memo_out_words);
+      return;
+    }
+    my_module->eval();
+    uint32_t out_words[kNumOutWords];
+    get_outputs(my_module, out_words);
+    if (memo_out_words == NULL)
+      memo_insert(*memo, in_words, out_words, hash);
+    else if (memcmp(memo_out_words, out_words, sizeof(out_words)))
+      memo->stats.verify_mismatches++;
+  }
+
+  /* digests the outputs of the tick that was just evaluated; returns the sum of the output words */
+  static inline uint64_t accumulate_outputs(const ModelT *my_module, DigestWriter &digests) {
+    uint32_t out_words[kNumOutWords];
+    port_load<OutWidth>(my_module->out_data, out_words);
+    digest_writer_push(digests, out_words, kNumOutWords);
+    return words_sum(out_words, std::make_index_sequence<kNumOutWords>());
+  }
+};
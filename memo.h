@@ -0,0 +1,150 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* fixed-size memoization of the outputs of a stateless model, keyed by its input words */
+#pragma once
+
+#include "stimulus.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+/*
+ * Open addressing with linear probing over at most MEMO_PROBE_LENGTH consecutive entries. An entry packs
+ * a 32-bit tag, the input words and the output words, padded to a power of two of words or to whole
+ * cache lines, so that a lookup usually touches a single cache line. The table never grows: when all the
+ * probed entries are taken, the first one is overwritten. Entries are never removed, so an empty entry,
+ * with a tag of 0, ends the probing.
+ */
+#define MEMO_PROBE_LENGTH 4
+#define MEMO_CACHE_LINE_WORDS 16
+
+struct MemoStats {
+  uint64_t lookups;
+  uint64_t hits;
+  uint64_t evictions;
+  // Hits whose outputs differed from those of the model, only counted when verifying.
+  uint64_t verify_mismatches;
+};
+
+struct MemoTable {
+  uint32_t *entries = NULL;
+  // A power of two.
+  uint64_t num_entries = 0;
+  uint32_t num_in_words = 0;
+  uint32_t num_out_words = 0;
+  uint32_t entry_words = 0;
+  // Evaluate on hits too, and compare the outputs with the memoized ones.
+  bool verify = false;
+  MemoStats stats = {};
+};
+
+/* allocates a table of at least num_entries entries, all empty */
+static bool memo_init(MemoTable &memo, uint64_t num_entries, uint32_t num_in_words, uint32_t num_out_words, bool verify)
+{
+  memo.num_entries = MEMO_PROBE_LENGTH;
+  while (memo.num_entries < num_entries)
+    memo.num_entries *= 2;
+  uint32_t entry_words = 1 + num_in_words + num_out_words;
+  memo.entry_words = 1;
+  while (memo.entry_words < entry_words && memo.entry_words < MEMO_CACHE_LINE_WORDS)
+    memo.entry_words *= 2;
+  if (memo.entry_words < entry_words)
+    memo.entry_words = (entry_words + MEMO_CACHE_LINE_WORDS - 1) / MEMO_CACHE_LINE_WORDS * MEMO_CACHE_LINE_WORDS;
+  memo.num_in_words = num_in_words;
+  memo.num_out_words = num_out_words;
+  memo.verify = verify;
+  memo.stats = {};
+
+  size_t num_bytes = memo.num_entries * memo.entry_words * sizeof(uint32_t);
+  memo.entries = (uint32_t *) aligned_alloc(MEMO_CACHE_LINE_WORDS * sizeof(uint32_t), num_bytes);
+  if (memo.entries == NULL) {
+    std::cerr << "Could not allocate " << std::dec << num_bytes << " bytes for the memoization table." << std::endl;
+    return false;
+  }
+  memset(memo.entries, 0, num_bytes);
+  return true;
+}
+
+static void memo_free(MemoTable &memo)
+{
+  free(memo.entries);
+  memo.entries = NULL;
+}
+
+static inline uint64_t memo_hash(const uint32_t *in_words, uint32_t num_in_words)
+{
+  uint64_t hash = num_in_words;
+  uint32_t i = 0;
+  for (; i + 1 < num_in_words; i += 2)
+    hash = stimulus_mix64(hash ^ (in_words[i] | (uint64_t) in_words[i + 1] << 32));
+  if (i < num_in_words)
+    hash = stimulus_mix64(hash ^ in_words[i]);
+  return hash;
+}
+
+/* the low half of the hash picks the first entry, and the high half is the tag */
+static inline uint32_t *memo_entry(const MemoTable &memo, uint64_t hash, int probe_id)
+{
+  return memo.entries + ((hash + probe_id) & (memo.num_entries - 1)) * memo.entry_words;
+}
+
+static inline uint32_t memo_tag(uint64_t hash)
+{
+  uint32_t tag = (uint32_t) (hash >> 32);
+  return tag == 0 ? 1 : tag;
+}
+
+/* returns the memoized output words of in_words, or NULL */
+static inline const uint32_t *memo_lookup(MemoTable &memo, const uint32_t *in_words, uint64_t hash)
+{
+  memo.stats.lookups++;
+  uint32_t tag = memo_tag(hash);
+  for (int probe_id = 0; probe_id < MEMO_PROBE_LENGTH; probe_id++) {
+    const uint32_t *entry = memo_entry(memo, hash, probe_id);
+    if (entry[0] == 0)
+      return NULL;
+    if (entry[0] == tag && !memcmp(entry + 1, in_words, memo.num_in_words * sizeof(uint32_t))) {
+      memo.stats.hits++;
+      return entry + 1 + memo.num_in_words;
+    }
+  }
+  return NULL;
+}
+
+/* memoizes the output words of in_words, which must not be in the table yet */
+static inline void memo_insert(MemoTable &memo, const uint32_t *in_words, const uint32_t *out_words, uint64_t hash)
+{
+  uint32_t *entry = NULL;
+  for (int probe_id = 0; probe_id < MEMO_PROBE_LENGTH && entry == NULL; probe_id++) {
+    uint32_t *candidate = memo_entry(memo, hash, probe_id);
+    if (candidate[0] == 0)
+      entry = candidate;
+  }
+  if (entry == NULL) {
+    entry = memo_entry(memo, hash, 0);
+    memo.stats.evictions++;
+  }
+  entry[0] = memo_tag(hash);
+  memcpy(entry + 1, in_words, memo.num_in_words * sizeof(uint32_t));
+  memcpy(entry + 1 + memo.num_in_words, out_words, memo.num_out_words * sizeof(uint32_t));
+}
+
+static void memo_stats_merge(MemoStats &stats, const MemoStats &other)
+{
+  stats.lookups += other.lookups;
+  stats.hits += other.hits;
+  stats.evictions += other.evictions;
+  stats.verify_mismatches += other.verify_mismatches;
+}
+
+static void memo_stats_print(std::ostream &out, const MemoStats &stats, bool verify)
+{
+  out << "Memoization: " << std::dec << stats.hits << " hits of " << stats.lookups << " lookups ("
+      << (stats.lookups > 0 ? 100.0 * stats.hits / stats.lookups : 0.0) << "%), " << stats.evictions << " evictions." << std::endl;
+  if (verify)
+    out << "Memoization mismatches: " << std::dec << stats.verify_mismatches << "." << std::endl;
+}
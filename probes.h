@@ -0,0 +1,164 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* per-tick binary dumps of internal signals selected by name at runtime, decoded by decode_probes.py */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+/*
+ * Probe file format (little endian): ProbeFileHeader, then for each probed signal a ProbeFileSignal followed
+ * by its name_len name bytes, then num_ticks records of record_bytes bytes, for the ticks from first_tick on.
+ * A record concatenates the Verilator storage of the signals, in order: 1, 2, 4 or 8 bytes up to 64 bits,
+ * and 32-bit words above, where the bits above the width of a signal are 0.
+ */
+#define PROBE_FILE_MAGIC "TBPROBE1"
+
+// Bytes of records buffered by a ProbeWriter between two writes.
+#define PROBE_WRITER_BUFFER_BYTES (1 << 20)
+
+struct ProbeFileHeader {
+  char magic[8];
+  uint32_t num_signals;
+  uint32_t record_bytes;
+  uint64_t first_tick;
+  uint64_t num_ticks;
+};
+static_assert(sizeof(ProbeFileHeader) == 32, "The probe file header must stay packed.");
+
+struct ProbeFileSignal {
+  uint32_t width;
+  uint32_t num_bytes;
+  uint32_t name_len;
+};
+
+struct ProbeSignal {
+  const char *name;
+  int width;
+  // Storage of the signal in a model, or NULL in a table built without a model.
+  const void *data;
+  int num_bytes;
+};
+
+/* writes the records of a contiguous range of ticks */
+struct ProbeWriter {
+  int fd;
+  off_t records_offset;
+  uint64_t first_tick;
+  uint64_t next_tick;
+  std::vector<ProbeSignal> signals;
+  size_t record_bytes;
+  std::vector<uint8_t> buffer;
+  size_t num_buffered_bytes;
+
+  ProbeWriter(int fd, off_t records_offset, uint64_t first_tick, uint64_t tick_begin, const std::vector<ProbeSignal> &signals)
+      : fd(fd), records_offset(records_offset), first_tick(first_tick), next_tick(tick_begin), signals(signals), record_bytes(0), num_buffered_bytes(0) {
+    for (const ProbeSignal &signal : signals)
+      record_bytes += signal.num_bytes;
+    buffer.resize(std::max(record_bytes, (size_t) PROBE_WRITER_BUFFER_BYTES / record_bytes * record_bytes));
+  }
+};
+
+/*
+ * Selects the signals of the probe table whose name matches one of the comma-separated glob patterns, in table order.
+ * Returns false if a pattern matches no signal.
+ */
+static bool probe_select(const std::vector<ProbeSignal> &table, const char *patterns_str, std::vector<int> &probe_ids)
+{
+  std::vector<bool> selected(table.size(), false);
+  std::string patterns(patterns_str);
+  size_t pattern_begin = 0;
+  while (pattern_begin <= patterns.size()) {
+    size_t pattern_end = patterns.find(',', pattern_begin);
+    if (pattern_end == std::string::npos)
+      pattern_end = patterns.size();
+    std::string pattern = patterns.substr(pattern_begin, pattern_end - pattern_begin);
+    bool matched = false;
+    for (size_t i = 0; i < table.size(); i++) {
+      if (!fnmatch(pattern.c_str(), table[i].name, 0)) {
+        selected[i] = true;
+        matched = true;
+      }
+    }
+    if (!matched) {
+      std::cerr << "No probed signal matches " << pattern << (table.empty() ? ", generate probe_table.h with gen_probe_table.py." : ".") << std::endl;
+      return false;
+    }
+    pattern_begin = pattern_end + 1;
+  }
+  for (size_t i = 0; i < table.size(); i++) {
+    if (selected[i])
+      probe_ids.push_back(i);
+  }
+  return true;
+}
+
+static std::vector<ProbeSignal> probe_bind(const std::vector<ProbeSignal> &table, const std::vector<int> &probe_ids)
+{
+  std::vector<ProbeSignal> signals;
+  for (int probe_id : probe_ids)
+    signals.push_back(table[probe_id]);
+  return signals;
+}
+
+/* creates the probe file for the ticks [first_tick, first_tick + num_ticks); returns -1 on error */
+static int probe_file_create(const char *path, const std::vector<ProbeSignal> &signals, uint64_t first_tick, uint64_t num_ticks, off_t *records_offset)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) { std::cerr << "Could not create probe file " << path << "." << std::endl; return -1; }
+  ProbeFileHeader header;
+  memcpy(header.magic, PROBE_FILE_MAGIC, sizeof(header.magic));
+  header.num_signals = signals.size();
+  header.record_bytes = 0;
+  header.first_tick = first_tick;
+  header.num_ticks = num_ticks;
+  std::string descriptors;
+  for (const ProbeSignal &signal : signals) {
+    ProbeFileSignal descriptor = {(uint32_t) signal.width, (uint32_t) signal.num_bytes, (uint32_t) strlen(signal.name)};
+    descriptors.append((const char *) &descriptor, sizeof(descriptor));
+    descriptors.append(signal.name);
+    header.record_bytes += signal.num_bytes;
+  }
+  if(write(fd, &header, sizeof(header)) != sizeof(header) || write(fd, descriptors.data(), descriptors.size()) != (ssize_t) descriptors.size()) {
+    std::cerr << "Could not write probe file " << path << "." << std::endl; close(fd); return -1;
+  }
+  *records_offset = sizeof(header) + descriptors.size();
+  return fd;
+}
+
+static void probe_writer_flush(ProbeWriter &writer)
+{
+  if(writer.num_buffered_bytes == 0)
+    return;
+  uint64_t num_buffered_ticks = writer.num_buffered_bytes / writer.record_bytes;
+  off_t offset = writer.records_offset + (writer.next_tick - num_buffered_ticks - writer.first_tick) * writer.record_bytes;
+  if(pwrite(writer.fd, writer.buffer.data(), writer.num_buffered_bytes, offset) != (ssize_t) writer.num_buffered_bytes) {
+    std::cerr << "Could not write the probe file." << std::endl; exit(1);
+  }
+  writer.num_buffered_bytes = 0;
+}
+
+/* records the probed signals after the eval() of the next tick */
+static inline void probe_writer_push(ProbeWriter &writer)
+{
+  uint8_t *record = writer.buffer.data() + writer.num_buffered_bytes;
+  for (const ProbeSignal &signal : writer.signals) {
+    memcpy(record, signal.data, signal.num_bytes);
+    record += signal.num_bytes;
+  }
+  writer.num_buffered_bytes += writer.record_bytes;
+  writer.next_tick++;
+  if(writer.num_buffered_bytes == writer.buffer.size())
+    probe_writer_flush(writer);
+}
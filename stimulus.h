@@ -0,0 +1,296 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* stimulus storage shared by the testbenches: decimal text, memory-mapped binary, streamed binary or seeded generator */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <iostream>
+#include <fstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Binary stimulus format (little endian), as produced by convert_inputs.py:
+ *   StimulusHeader, then num_ticks * words_per_tick packed 32-bit words.
+ * words_per_tick is (IN_DATA_WIDTH + 31) / 32 for full random stimuli, and 1 otherwise.
+ */
+#define STIMULUS_MAGIC "TBSTIM01"
+
+struct StimulusHeader {
+  char magic[8];
+  uint32_t in_data_width;
+  uint32_t words_per_tick;
+  uint64_t num_ticks;
+};
+static_assert(sizeof(StimulusHeader) == 24, "The stimulus header must stay packed.");
+
+// Number of words read from the file per refill in streaming mode.
+#define STIMULUS_STREAM_CHUNK_WORDS (1 << 16)
+
+/*
+ * The built-in generator is counter based: every word is a hash of (seed, tick, word index), so any tick can be
+ * regenerated from (seed, tick) alone, and the words of a tick have no dependency on each other.
+ *   full:      all the input words are random.
+ *   replicate: a single random word per tick, replicated with an offset over all the input words, as with FULL_RANDOM=0.
+ *   bitflip:   every tick flips a few random bits of the previous input vector. The vector is redrawn in full every
+ *              STIMULUS_BITFLIP_PERIOD ticks, which bounds the replay needed to reach an arbitrary tick.
+ */
+enum StimulusGenMode { STIMULUS_GEN_OFF, STIMULUS_GEN_FULL, STIMULUS_GEN_REPLICATE, STIMULUS_GEN_BITFLIP };
+
+#define STIMULUS_BITFLIP_PERIOD 1024
+
+struct Stimulus {
+  // All the words, NULL in streaming mode.
+  const uint32_t *words = NULL;
+  size_t num_words = 0;
+  // Backing storage of the text format.
+  std::vector<uint32_t> text_words;
+  // Memory-mapped or streamed binary file.
+  int fd = -1;
+  void *map = NULL;
+  size_t map_len = 0;
+  // Built-in generator, used instead of the words unless gen_mode is STIMULUS_GEN_OFF.
+  // A cursor then still advances by gen_words_per_tick per tick, as it would in a file.
+  StimulusGenMode gen_mode = STIMULUS_GEN_OFF;
+  uint64_t gen_seed = 0;
+  int gen_flips_per_tick = 0;
+  size_t gen_words_per_tick = 0;
+};
+
+/* per-thread read position in a Stimulus */
+struct StimulusCursor {
+  const Stimulus *stimulus;
+  size_t curr_id;
+  // Streaming mode only: words [chunk_first_id, chunk_first_id + chunk.size()) of the stimulus.
+  std::vector<uint32_t> chunk;
+  size_t chunk_first_id;
+  // Bitflip generator only: the last generated input vector, which is that of tick gen_next_tick - 1.
+  std::vector<uint32_t> gen_vector;
+  uint64_t gen_next_tick;
+
+  StimulusCursor(const Stimulus *stimulus, size_t first_id) : stimulus(stimulus), curr_id(first_id), chunk_first_id(0), gen_next_tick(0) {}
+};
+
+/* the loaders report errors on stderr and return false, leaving the stimulus to be closed by the caller */
+static bool stimulus_load_text(Stimulus *stimulus, const char *path, size_t expected_num_words)
+{
+  std::ifstream in_file(path);
+  if(!in_file) { std::cerr << "Could not open stimulus file " << path << "." << std::endl; return false; }
+  stimulus->text_words.reserve(expected_num_words);
+  uint64_t next_random_input = 0;
+  while (stimulus->text_words.size() < expected_num_words && in_file >> next_random_input)
+    stimulus->text_words.push_back(next_random_input);
+  if(stimulus->text_words.size() != expected_num_words) {
+    std::cerr << "Stimulus file " << path << " only has " << stimulus->text_words.size() << " of the " << expected_num_words << " expected words." << std::endl;
+    return false;
+  }
+  stimulus->words = stimulus->text_words.data();
+  stimulus->num_words = stimulus->text_words.size();
+  return true;
+}
+
+/* opens a binary stimulus file and checks its header against the harness configuration */
+static bool stimulus_open_binary(Stimulus *stimulus, const char *path, bool streaming,
+                                 uint32_t in_data_width, uint32_t words_per_tick, uint64_t simlen)
+{
+  stimulus->fd = open(path, O_RDONLY);
+  if(stimulus->fd < 0) { std::cerr << "Could not open stimulus file " << path << "." << std::endl; return false; }
+
+  StimulusHeader header;
+  if(pread(stimulus->fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, STIMULUS_MAGIC, sizeof(header.magic))) {
+    std::cerr << path << " is not a binary stimulus file." << std::endl; return false;
+  }
+  if(header.in_data_width != in_data_width || header.words_per_tick != words_per_tick) {
+    std::cerr << "Stimulus file " << path << " has width " << header.in_data_width << " and " << header.words_per_tick
+              << " words per tick, expected " << in_data_width << " and " << words_per_tick << "." << std::endl;
+    return false;
+  }
+  if(header.num_ticks < simlen) {
+    std::cerr << "Stimulus file " << path << " only has " << header.num_ticks << " ticks." << std::endl; return false;
+  }
+  // A truncated file would otherwise only fail on the first access past its end, with a SIGBUS on the mapping.
+  struct stat file_stat;
+  if(fstat(stimulus->fd, &file_stat) || (uint64_t) file_stat.st_size < sizeof(header)
+     || ((uint64_t) file_stat.st_size - sizeof(header)) / sizeof(uint32_t) / words_per_tick < header.num_ticks) {
+    std::cerr << "Stimulus file " << path << " is shorter than its " << header.num_ticks << " ticks." << std::endl; return false;
+  }
+  stimulus->num_words = simlen * words_per_tick;
+  if(streaming)
+    return true;
+
+  stimulus->map_len = sizeof(header) + stimulus->num_words * sizeof(uint32_t);
+  stimulus->map = mmap(NULL, stimulus->map_len, PROT_READ, MAP_PRIVATE, stimulus->fd, 0);
+  if(stimulus->map == MAP_FAILED) {
+    stimulus->map = NULL;
+    std::cerr << "Could not map stimulus file " << path << "." << std::endl; return false;
+  }
+  madvise(stimulus->map, stimulus->map_len, MADV_SEQUENTIAL);
+  madvise(stimulus->map, stimulus->map_len, MADV_WILLNEED);
+  stimulus->words = (const uint32_t *) ((const char *) stimulus->map + sizeof(header));
+  return true;
+}
+
+/* sets up the built-in generator; mode_name is full, replicate or bitflip */
+static bool stimulus_init_generator(Stimulus *stimulus, const char *mode_name, uint64_t seed, int flips_per_tick,
+                                    size_t words_per_tick, uint64_t simlen)
+{
+  if(!strcmp(mode_name, "full"))
+    stimulus->gen_mode = STIMULUS_GEN_FULL;
+  else if(!strcmp(mode_name, "replicate"))
+    stimulus->gen_mode = STIMULUS_GEN_REPLICATE;
+  else if(!strcmp(mode_name, "bitflip"))
+    stimulus->gen_mode = STIMULUS_GEN_BITFLIP;
+  else {
+    std::cerr << "Unknown stimulus mode " << mode_name << ", expected full, replicate or bitflip." << std::endl; return false;
+  }
+  stimulus->gen_seed = seed;
+  stimulus->gen_flips_per_tick = flips_per_tick;
+  stimulus->gen_words_per_tick = words_per_tick;
+  stimulus->num_words = simlen * words_per_tick;
+  return true;
+}
+
+/* writes num_ticks ticks of words in the binary stimulus format */
+static bool stimulus_write_binary(const char *path, uint32_t in_data_width, uint32_t words_per_tick, const uint32_t *words, uint64_t num_ticks)
+{
+  FILE *f = fopen(path, "wb");
+  if(f == NULL) { std::cerr << "Could not write stimulus file " << path << "." << std::endl; return false; }
+  StimulusHeader header;
+  memcpy(header.magic, STIMULUS_MAGIC, sizeof(header.magic));
+  header.in_data_width = in_data_width;
+  header.words_per_tick = words_per_tick;
+  header.num_ticks = num_ticks;
+  bool written = fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(words, sizeof(uint32_t), num_ticks * words_per_tick, f) == num_ticks * words_per_tick;
+  fclose(f);
+  if(!written) { std::cerr << "Could not write stimulus file " << path << "." << std::endl; return false; }
+  return true;
+}
+
+static void stimulus_close(Stimulus *stimulus)
+{
+  if(stimulus->map != NULL)
+    munmap(stimulus->map, stimulus->map_len);
+  if(stimulus->fd >= 0)
+    close(stimulus->fd);
+  stimulus->text_words.clear();
+  *stimulus = Stimulus();
+}
+
+static void stimulus_refill(StimulusCursor &cursor, size_t count)
+{
+  const Stimulus *stimulus = cursor.stimulus;
+  size_t num_chunk_words = std::min(std::max((size_t) STIMULUS_STREAM_CHUNK_WORDS, count), stimulus->num_words - cursor.curr_id);
+  cursor.chunk.resize(num_chunk_words);
+  cursor.chunk_first_id = cursor.curr_id;
+  size_t num_bytes = num_chunk_words * sizeof(uint32_t);
+  off_t offset = sizeof(StimulusHeader) + cursor.curr_id * sizeof(uint32_t);
+  if(pread(stimulus->fd, cursor.chunk.data(), num_bytes, offset) != (ssize_t) num_bytes) {
+    std::cerr << "Could not read the stimulus file." << std::endl; exit(1);
+  }
+}
+
+/* returns the next count words of the stimulus and advances the cursor */
+static inline const uint32_t *stimulus_next_words(StimulusCursor &cursor, size_t count)
+{
+  assert(cursor.curr_id + count <= cursor.stimulus->num_words);
+  const uint32_t *ret;
+  if(cursor.stimulus->words != NULL) {
+    ret = cursor.stimulus->words + cursor.curr_id;
+  } else {
+    if(cursor.curr_id < cursor.chunk_first_id || cursor.curr_id + count > cursor.chunk_first_id + cursor.chunk.size())
+      stimulus_refill(cursor, count);
+    ret = cursor.chunk.data() + (cursor.curr_id - cursor.chunk_first_id);
+  }
+  cursor.curr_id += count;
+  return ret;
+}
+
+/* splitmix64 finalizer */
+static inline uint64_t stimulus_mix64(uint64_t x)
+{
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+// Independent streams of the generator.
+#define STIMULUS_STREAM_WORDS 0x5157494f524453ull
+#define STIMULUS_STREAM_FLIPS 0x464c495053ull
+
+static inline uint64_t stimulus_gen_u64(uint64_t seed, uint64_t stream, uint64_t counter)
+{
+  return stimulus_mix64(stimulus_mix64(seed ^ stream) + counter * 0x9e3779b97f4a7c15ull);
+}
+
+/* fills num_in_words random words for a tick; the iterations are independent so that the loop vectorizes */
+static inline void stimulus_gen_fill(uint64_t seed, uint64_t tick_id, uint32_t *in_words, int num_in_words)
+{
+  uint64_t key = stimulus_mix64(seed ^ STIMULUS_STREAM_WORDS);
+  uint64_t first_counter = tick_id * (uint64_t) num_in_words;
+  for (int i = 0; i < num_in_words; i++)
+    in_words[i] = (uint32_t) (stimulus_mix64(key + (first_counter + i) * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static inline void stimulus_gen_flip_bits(const Stimulus *stimulus, uint64_t tick_id, uint32_t *in_words, int num_in_words)
+{
+  for (int flip_id = 0; flip_id < stimulus->gen_flips_per_tick; flip_id++) {
+    uint64_t bit_id = stimulus_gen_u64(stimulus->gen_seed, STIMULUS_STREAM_FLIPS, tick_id * stimulus->gen_flips_per_tick + flip_id) % (32 * (uint64_t) num_in_words);
+    in_words[bit_id / 32] ^= 1u << (bit_id % 32);
+  }
+}
+
+static void stimulus_gen_input_vector(StimulusCursor &cursor, uint64_t tick_id, uint32_t *in_words, int num_in_words)
+{
+  const Stimulus *stimulus = cursor.stimulus;
+  if(stimulus->gen_mode == STIMULUS_GEN_FULL) {
+    stimulus_gen_fill(stimulus->gen_seed, tick_id, in_words, num_in_words);
+  } else if(stimulus->gen_mode == STIMULUS_GEN_REPLICATE) {
+    uint32_t random_input = (uint32_t) (stimulus_gen_u64(stimulus->gen_seed, STIMULUS_STREAM_WORDS, tick_id) >> 32);
+    for (int i = 0; i < num_in_words; i++)
+      in_words[i] = random_input + i;
+  } else {
+    uint64_t period_first_tick = tick_id - tick_id % STIMULUS_BITFLIP_PERIOD;
+    std::vector<uint32_t> &vector = cursor.gen_vector;
+    if(tick_id == period_first_tick || (int) vector.size() != num_in_words || cursor.gen_next_tick != tick_id) {
+      // Not following the previous tick, for example at the start of a shard: replay from the start of the period.
+      vector.resize(num_in_words);
+      stimulus_gen_fill(stimulus->gen_seed, period_first_tick, vector.data(), num_in_words);
+      for (uint64_t replayed_tick_id = period_first_tick + 1; replayed_tick_id <= tick_id; replayed_tick_id++)
+        stimulus_gen_flip_bits(stimulus, replayed_tick_id, vector.data(), num_in_words);
+    } else {
+      stimulus_gen_flip_bits(stimulus, tick_id, vector.data(), num_in_words);
+    }
+    cursor.gen_next_tick = tick_id + 1;
+    memcpy(in_words, vector.data(), num_in_words * sizeof(uint32_t));
+  }
+}
+
+/* expands the next tick of the stimulus into num_in_words input words */
+static inline void stimulus_next_input_vector(StimulusCursor &cursor, uint32_t *in_words, int num_in_words, bool full_random)
+{
+  if(cursor.stimulus->gen_mode != STIMULUS_GEN_OFF) {
+    assert(cursor.curr_id + cursor.stimulus->gen_words_per_tick <= cursor.stimulus->num_words);
+    uint64_t tick_id = cursor.curr_id / cursor.stimulus->gen_words_per_tick;
+    cursor.curr_id += cursor.stimulus->gen_words_per_tick;
+    stimulus_gen_input_vector(cursor, tick_id, in_words, num_in_words);
+  } else if(full_random) {
+    const uint32_t *random_inputs = stimulus_next_words(cursor, num_in_words);
+    for (int i = 0; i < num_in_words; i++)
+      in_words[i] = random_inputs[i];
+  } else {
+    // A single random word per tick, replicated with an offset over all the input words.
+    uint32_t random_input = *stimulus_next_words(cursor, 1);
+    for (int i = 0; i < num_in_words; i++)
+      in_words[i] = random_input + i;
+  }
+}
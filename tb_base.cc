@@ -5,12 +5,28 @@
 #include "Vtop.h"
 #include "verilated.h"
 #include "ticks.h"
+#include "stimulus.h"
+#include "digest.h"
+#include "checkpoint.h"
+#include "tick_stats.h"
+#include "harness.h"
+#include "coverage.h"
+#include "affinity.h"
+#include "memo.h"
+#include "probes.h"
 
 #include <iostream>
 #include <stdlib.h>
 #include <chrono>
 #include <fstream>
 #include <cassert>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #if VM_TRACE
 #if VM_TRACE_FST
@@ -18,17 +34,78 @@
 #else
 #include <verilated_vcd_c.h>
 #endif // VM_TRACE_FST
+#include "async_trace.h"
 #endif // VM_TRACE
 
 // This is a generated header
 #include "interface_sizes.h"
 
+// Generated by gen_coverage_signals.py, lists the internal signals sampled for toggle coverage.
+// They live in the root class of the model, which Vtop.h only declares.
+#if __has_include("coverage_signals.h")
+#include "coverage_signals.h"
+#include "Vtop___024root.h"
+#else
+#define COVERAGE_SIGNALS(X)
+#endif
+
+// Generated by gen_probe_table.py, lists the internal signals that PROBES can select.
+#if __has_include("probe_table.h")
+#include "probe_table.h"
+#include "Vtop___024root.h"
+#else
+#define PROBE_SIGNALS(X)
+#endif
+
 typedef Vtop Module;
+typedef Harness<Module, IN_DATA_WIDTH, OUT_DATA_WIDTH, FULL_RANDOM> TbHarness;
 
 #define PATH_TO_METADATA "tmp/metadata.log"
 
-size_t curr_id_in_random_inputs_from_file = 0;
-std::vector<uint32_t> random_inputs_from_file;
+// Number of entries of random_inputs_from_file consumed by each tick.
+#define NUM_RANDOM_INPUTS_PER_TICK (TbHarness::kNumRandomInputsPerTick)
+
+Stimulus random_inputs_from_file;
+// Fingerprint of the stimulus source, recorded in the checkpoints.
+uint64_t stimulus_fingerprint = 0;
+
+// Digest log of the run, or -1, and the output digest chaining all the per-tick digests.
+int digest_log_fd = -1;
+uint32_t output_digest = DIGEST_SEED;
+
+// Checkpoint period in ticks, or 0, and traced window of ticks, where trace_to < 0 stands for simlen.
+int checkpoint_every = 0;
+std::string checkpoint_dir;
+int trace_from = 0;
+int trace_to = -1;
+
+// Per-phase latency histograms, or NULL when STATSFILE is unset.
+TickStats *tick_stats = NULL;
+
+// Toggle coverage of the run, or NULL when neither COVERAGE_FILE nor __AFL_SHM_ID is set.
+ToggleCoverage *toggle_coverage = NULL;
+
+// Eval threads of each model, or 0 to keep the context default, and the CPUs to pin the simulation threads to, if any.
+int eval_threads = 0;
+std::vector<int> sim_cpus;
+// Models are constructed one at a time, so that the threads each one spawns can be told apart.
+// Any other thread creation must hold it too, or its threads would be taken for those of the model being constructed.
+std::mutex model_construction_mutex;
+// Scheduler statistics of the threads of all the models over the run.
+std::vector<ThreadCpuTime> sim_thread_times;
+std::mutex sim_thread_times_mutex;
+
+// Entries of the memoization table of each model, or 0, and the memoization statistics of all the models over the run.
+uint64_t memo_entries = 0;
+bool memo_verify = false;
+MemoStats memo_stats = {};
+std::mutex memo_stats_mutex;
+
+// Probe file of the run, or -1, the offset of its first record and its first tick, and the probed signals in the probe table.
+int probe_fd = -1;
+off_t probe_records_offset = 0;
+int probe_first_tick = 0;
+std::vector<int> probe_ids;
 
 #if VM_TRACE
 const int kTraceLevel = 6;
@@ -37,356 +114,557 @@ const int kTraceLevel = 6;
 #else
   VerilatedVcdC *trace_;
 #endif // VM_TRACE_FST
+// In asynchronous mode, the trace is written by a background thread from the captured signal changes.
+AsyncTraceWriter *async_trace = NULL;
+// CPU of the asynchronous trace writer, or -1.
+int trace_writer_cpu = -1;
+
+/*
+ * Ends the trace of the run, if any; also registered with atexit, so that the error paths exit with a complete trace.
+ * The full synchronous trace is only flushed and left open, as it always was, so that it still reproduces the
+ * VCD corruption shown in the README. The asynchronous and windowed traces are closed.
+ */
+void close_trace(void) {
+  if (async_trace != NULL) {
+    async_trace->close();
+    delete async_trace;
+    async_trace = NULL;
+  }
+  if (trace_ != NULL && trace_from == 0) {
+    trace_->flush();
+    trace_ = NULL;
+  } else if (trace_ != NULL) {
+    trace_->close();
+    delete trace_;
+    trace_ = NULL;
+  }
+}
 #endif // VM_TRACE
 
 void read_random_inputs_from_file(int simlen) {
   // Make sure we call this function only once
-  assert(random_inputs_from_file.size() == 0);
+  assert(random_inputs_from_file.num_words == 0);
 
-  std::ifstream in_file(PATH_TO_RANDOM_INPUTS_FILE);
-  int expected_num_ints = FULL_RANDOM ? simlen * IN_DATA_WIDTH / 32 : simlen;
-  uint64_t next_random_input = 0;
-  while (in_file >> next_random_input && random_inputs_from_file.size() < expected_num_ints) {
-      random_inputs_from_file.push_back(next_random_input);
+  const char *stimulus_path = cl_get_stimfile();
+  uint64_t seed;
+  bool loaded;
+  std::ostringstream description;
+  if (cl_get_stim_seed(&seed)) {
+    loaded = stimulus_init_generator(&random_inputs_from_file, cl_get_stim_mode(FULL_RANDOM), seed, cl_get_stim_flips(), NUM_RANDOM_INPUTS_PER_TICK, simlen);
+    description << "generator " << cl_get_stim_mode(FULL_RANDOM) << " " << seed << " " << cl_get_stim_flips();
+  } else if (stimulus_path == NULL) {
+    loaded = stimulus_load_text(&random_inputs_from_file, PATH_TO_RANDOM_INPUTS_FILE, (size_t) simlen * NUM_RANDOM_INPUTS_PER_TICK);
+    // The fuzzing flow rewrites this path on every iteration, so the fingerprint covers the words that were loaded.
+    description << "text " << PATH_TO_RANDOM_INPUTS_FILE << " "
+                << checkpoint_fingerprint(random_inputs_from_file.text_words.data(), random_inputs_from_file.text_words.size() * sizeof(uint32_t));
+  } else {
+    loaded = stimulus_open_binary(&random_inputs_from_file, stimulus_path, cl_get_stim_streaming(), IN_DATA_WIDTH, NUM_RANDOM_INPUTS_PER_TICK, simlen);
+    // The size and modification time tell apart the successive stimuli written to the same path.
+    struct stat stimulus_stat;
+    description << "binary " << stimulus_path;
+    if (stat(stimulus_path, &stimulus_stat) == 0)
+      description << " " << stimulus_stat.st_size << " " << stimulus_stat.st_mtim.tv_sec << "." << stimulus_stat.st_mtim.tv_nsec;
   }
-  assert(random_inputs_from_file.size() == expected_num_ints);
+  if (!loaded)
+    exit(1);
+  stimulus_fingerprint = checkpoint_fingerprint(description.str());
 }
 
-void randomize_inputs(Module *my_module) {
-#if FULL_RANDOM == 1
-  for (int i = 0; i < IN_DATA_WIDTH / 32; i++) {
-    my_module->in_data[i] = random_inputs_from_file[curr_id_in_random_inputs_from_file++];
+void randomize_inputs(Module *my_module, StimulusCursor &cursor) {
+  TbHarness::randomize_inputs(my_module, cursor);
+}
+
+/**
+ * Constructs a module on its own context with eval_threads threads.
+ * With cpus, the calling thread and the threads of the model are each pinned to one of them,
+ * and the model memory is first touched from these CPUs.
+ *
+ * @param model_tids receives the ids of the calling thread and of the model threads
+ */
+Module *construct_module(VerilatedContext *contextp, const std::vector<int> &cpus, std::vector<pid_t> *model_tids) {
+  std::lock_guard<std::mutex> lock(model_construction_mutex);
+  if (eval_threads > 0)
+    contextp->threads(eval_threads);
+  if (!cpus.empty() && !pin_thread(current_thread_id(), cpus.data(), cpus.size()))
+    exit(1);
+  std::vector<pid_t> tids_before = process_thread_ids();
+  Module *my_module = new Module(contextp);
+  *model_tids = model_threads_pin(tids_before, cpus);
+  return my_module;
+}
+
+/* adds the scheduler statistics of model threads since start_times to those of the run */
+void record_thread_times(const std::vector<pid_t> &model_tids, const std::vector<ThreadCpuTime> &start_times) {
+  std::vector<ThreadCpuTime> times = thread_cpu_times(model_tids);
+  thread_cpu_times_diff(times, start_times);
+  std::lock_guard<std::mutex> lock(sim_thread_times_mutex);
+  sim_thread_times.insert(sim_thread_times.end(), times.begin(), times.end());
+}
+
+/* allocates the memoization table of a model, or returns NULL when MEMO_ENTRIES is unset */
+MemoTable *create_memo_table() {
+  if (memo_entries == 0)
+    return NULL;
+  MemoTable *memo = new MemoTable;
+  if (!memo_init(*memo, memo_entries, TbHarness::kNumInWords, TbHarness::kNumOutWords, memo_verify))
+    exit(1);
+  return memo;
+}
+
+/* adds the statistics of a memoization table to those of the run, and frees it */
+void release_memo_table(MemoTable *memo) {
+  if (memo == NULL)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(memo_stats_mutex);
+    memo_stats_merge(memo_stats, memo->stats);
   }
-#else
-  int random_input = random_inputs_from_file[curr_id_in_random_inputs_from_file++];
-  for (int i = 0; i < IN_DATA_WIDTH / 32; i++)
-    my_module->in_data[i] = random_input + i;
-#endif
+  memo_free(*memo);
+  delete memo;
+}
+
+/**
+ * Lists the signals of PROBE_SIGNALS, with their storage in my_module, or without storage if my_module is NULL.
+ */
+std::vector<ProbeSignal> probe_table(Module *my_module) {
+  std::vector<ProbeSignal> table;
+#define ADD_PROBE_SIGNAL(name, width) \
+  table.push_back({#name, width, my_module == NULL ? NULL : &my_module->rootp->top__DOT__##name, (int) sizeof(my_module->rootp->top__DOT__##name)});
+  PROBE_SIGNALS(ADD_PROBE_SIGNAL)
+#undef ADD_PROBE_SIGNAL
+  return table;
+}
+
+#if VM_TRACE
+/**
+ * Lists the ports of the model, traced in asynchronous mode together with the internal signals of probe_table.h.
+ */
+std::vector<ProbeSignal> trace_ports(Module *my_module) {
+  std::vector<ProbeSignal> ports;
+  ports.push_back({"in_data", IN_DATA_WIDTH, &my_module->in_data, (int) sizeof(my_module->in_data)});
+  ports.push_back({"out_data", OUT_DATA_WIDTH, &my_module->out_data, (int) sizeof(my_module->out_data)});
+  return ports;
+}
+#endif // VM_TRACE
+
+/* returns the probe writer of the ticks from tick_begin on, or NULL when PROBES is unset */
+ProbeWriter *create_probe_writer(Module *my_module, int tick_begin) {
+  if (probe_fd < 0)
+    return NULL;
+  return new ProbeWriter(probe_fd, probe_records_offset, probe_first_tick, tick_begin, probe_bind(probe_table(my_module), probe_ids));
+}
+
+/**
+ * Registers out_data and the signals of COVERAGE_SIGNALS for toggle coverage.
+ */
+void setup_coverage(ToggleCoverage &coverage, Module *my_module) {
+  coverage_add_signal(coverage, "out_data", &my_module->out_data, sizeof(my_module->out_data));
+#define ADD_COVERAGE_SIGNAL(name) \
+  coverage_add_signal(coverage, #name, &my_module->rootp->top__DOT__##name, sizeof(my_module->rootp->top__DOT__##name));
+  COVERAGE_SIGNALS(ADD_COVERAGE_SIGNAL)
+#undef ADD_COVERAGE_SIGNAL
 }
 
 /**
  * Runs the testbench.
+ * With trace_from > 0, resumes from the nearest checkpoint and only traces the ticks [trace_from, trace_to).
+ * With trace_to >= 0, stops after the tick trace_to - 1, so the signature and digest only cover the ticks before trace_to.
  *
  * @param tb a pointer to a testbench instance
  * @param simlen the number of cycles to run
  */
 std::pair<long, uint64_t> run_test(Module *my_module, int simlen, const std::string trace_filename) {
-  
-  srand(time(NULL)); // set random seed to current time
   uint64_t cumulated_output = 0;
+  StimulusCursor curr_id_in_random_inputs_from_file(&random_inputs_from_file, 0);
+  int first_tick_id = 0;
+  int last_tick_id = trace_to < 0 ? simlen : trace_to;
+  uint32_t digest_chain = DIGEST_SEED;
+
+  uint64_t checkpoint_tick_id = 0;
+  if (trace_from > 0 && checkpoint_find_nearest(checkpoint_dir, trace_from, &checkpoint_tick_id)) {
+    CheckpointHeader checkpoint;
+    if (!checkpoint_restore(checkpoint_dir, checkpoint_tick_id, stimulus_fingerprint, simlen, &checkpoint, my_module))
+      exit(1);
+    std::cout << "Resuming from the checkpoint of tick " << std::dec << checkpoint_tick_id << "." << std::endl;
+    first_tick_id = checkpoint.tick_id;
+    curr_id_in_random_inputs_from_file.curr_id = checkpoint.curr_id_in_random_inputs_from_file;
+    cumulated_output = checkpoint.cumulated_output;
+    digest_chain = checkpoint.digest_chain;
+  }
+  DigestWriter digests(digest_log_fd, first_tick_id, digest_chain);
+  if (toggle_coverage != NULL)
+    setup_coverage(*toggle_coverage, my_module);
+  MemoTable *memo = create_memo_table();
+  // Probes cover the same window as the trace.
+  ProbeWriter *probes = create_probe_writer(my_module, trace_from);
   auto start = std::chrono::steady_clock::now();
 
 #if VM_TRACE
+  size_t tick_count_ = trace_from;
+#endif // VM_TRACE
+
+  for (int tick_id = first_tick_id; tick_id < last_tick_id; tick_id++) {
+    if (checkpoint_every > 0 && tick_id % checkpoint_every == 0) {
+      CheckpointHeader checkpoint;
+      checkpoint.tick_id = tick_id;
+      checkpoint.curr_id_in_random_inputs_from_file = curr_id_in_random_inputs_from_file.curr_id;
+      checkpoint.cumulated_output = cumulated_output;
+      checkpoint.digest_chain = digests.chain;
+      checkpoint.stimulus_fingerprint = stimulus_fingerprint;
+      checkpoint.simlen = simlen;
+      if (!checkpoint_save(checkpoint_dir, checkpoint, my_module))
+        exit(1);
+    }
+#if VM_TRACE
+    if (tick_id == trace_from && cl_get_trace_async()) {
+      // The eval thread only captures the changed values, and the writer thread formats them.
+      async_trace = new AsyncTraceWriter(trace_ports(my_module), probe_table(my_module), tick_count_, trace_writer_cpu);
+      if (!async_trace->open(trace_filename))
+        exit(1);
+      atexit(close_trace);
+      async_trace->capture();
+    } else if (tick_id == trace_from) {
 #if VM_TRACE_FST
-    trace_ = new VerilatedFstC;
+      trace_ = new VerilatedFstC;
 #else
-    trace_ = new VerilatedVcdC;
+      trace_ = new VerilatedVcdC;
 #endif // VM_TRACE_FST
-    my_module->trace(trace_, kTraceLevel);
-    trace_->open(trace_filename.c_str());
-    size_t tick_count_ = 0;
-    trace_->dump(tick_count_++);
+      my_module->trace(trace_, kTraceLevel);
+      trace_->open(trace_filename.c_str());
+      if (!trace_->isOpen()) { std::cerr << "Could not open trace file " << trace_filename << "." << std::endl; exit(1); }
+      atexit(close_trace);
+      trace_->dump(tick_count_++);
+    }
 #endif // VM_TRACE
 
-  for (int tick_id = 0; tick_id < simlen; tick_id++) {
-    randomize_inputs(my_module);
-    my_module->eval();
+    uint64_t tick_start = tick_stats_start(tick_stats);
+    uint64_t lap = tick_start;
+    randomize_inputs(my_module, curr_id_in_random_inputs_from_file);
+    tick_stats_lap(tick_stats, TICK_PHASE_RANDOMIZE_INPUTS, &lap);
+    TbHarness::eval_memoized(my_module, memo);
+    tick_stats_lap(tick_stats, TICK_PHASE_EVAL, &lap);
 #if VM_TRACE
+    if (async_trace != NULL)
+      async_trace->capture();
+    else if (tick_id >= trace_from)
       trace_->dump(tick_count_++);
+    tick_stats_lap(tick_stats, TICK_PHASE_TRACE, &lap);
 #endif // VM_TRACE
 
-    for (int i = 0; i < OUT_DATA_WIDTH / 32; i++) {
-      cumulated_output += my_module->out_data[i];
+    cumulated_output += TbHarness::accumulate_outputs(my_module, digests);
+    tick_stats_lap(tick_stats, TICK_PHASE_ACCUMULATE_OUTPUTS, &lap);
+    if (toggle_coverage != NULL) {
+      coverage_sample(*toggle_coverage);
+      tick_stats_lap(tick_stats, TICK_PHASE_COVERAGE, &lap);
     }
-
-    // std::cout << "signal000_" << std::hex << my_module->signal000_ << std::endl;
-    // std::cout << "signal001_" << std::hex << my_module->signal001_ << std::endl;
-    // std::cout << "signal002_" << std::hex << my_module->signal002_ << std::endl;
-    // std::cout << "signal003_" << std::hex << my_module->signal003_ << std::endl;
-    // std::cout << "signal004_" << std::hex << my_module->signal004_ << std::endl;
-    // std::cout << "signal005_" << std::hex << my_module->signal005_ << std::endl;
-    // std::cout << "signal006_" << std::hex << my_module->signal006_ << std::endl;
-    // std::cout << "signal007_" << std::hex << my_module->signal007_ << std::endl;
-    // std::cout << "signal008_" << std::hex << my_module->signal008_ << std::endl;
-    // std::cout << "signal009_" << std::hex << my_module->signal009_ << std::endl;
-    // std::cout << "signal010_" << std::hex << my_module->signal010_ << std::endl;
-    // std::cout << "signal011_" << std::hex << my_module->signal011_ << std::endl;
-    // std::cout << "signal012_" << std::hex << my_module->signal012_ << std::endl;
-    // std::cout << "signal013_" << std::hex << my_module->signal013_ << std::endl;
-    // std::cout << "signal014_" << std::hex << my_module->signal014_ << std::endl;
-    // std::cout << "signal015_" << std::hex << my_module->signal015_ << std::endl;
-    // std::cout << "signal016_" << std::hex << my_module->signal016_ << std::endl;
-    // std::cout << "signal017_" << std::hex << my_module->signal017_ << std::endl;
-    // std::cout << "signal018_" << std::hex << my_module->signal018_ << std::endl;
-    // std::cout << "signal019_" << std::hex << my_module->signal019_ << std::endl;
-    // std::cout << "signal020_" << std::hex << my_module->signal020_ << std::endl;
-    // std::cout << "signal021_" << std::hex << my_module->signal021_ << std::endl;
-    // std::cout << "signal022_" << std::hex << my_module->signal022_ << std::endl;
-    // std::cout << "signal023_" << std::hex << my_module->signal023_ << std::endl;
-    // std::cout << "signal024_" << std::hex << my_module->signal024_ << std::endl;
-    // std::cout << "signal025_" << std::hex << my_module->signal025_ << std::endl;
-    // std::cout << "signal026_" << std::hex << my_module->signal026_ << std::endl;
-    // std::cout << "signal027_" << std::hex << my_module->signal027_ << std::endl;
-    // std::cout << "signal028_" << std::hex << my_module->signal028_ << std::endl;
-    // std::cout << "signal029_" << std::hex << my_module->signal029_ << std::endl;
-    // std::cout << "signal030_" << std::hex << my_module->signal030_ << std::endl;
-    // std::cout << "signal031_" << std::hex << my_module->signal031_ << std::endl;
-    // std::cout << "signal032_" << std::hex << my_module->signal032_ << std::endl;
-    // std::cout << "signal033_" << std::hex << my_module->signal033_ << std::endl;
-    // std::cout << "signal034_" << std::hex << my_module->signal034_ << std::endl;
-    // std::cout << "signal035_" << std::hex << my_module->signal035_ << std::endl;
-    // std::cout << "signal036_" << std::hex << my_module->signal036_ << std::endl;
-    // std::cout << "signal037_" << std::hex << my_module->signal037_ << std::endl;
-    // std::cout << "signal038_" << std::hex << my_module->signal038_ << std::endl;
-    // std::cout << "signal039_" << std::hex << my_module->signal039_ << std::endl;
-    // std::cout << "signal040_" << std::hex << my_module->signal040_ << std::endl;
-    // std::cout << "signal041_" << std::hex << my_module->signal041_ << std::endl;
-    // std::cout << "signal042_" << std::hex << my_module->signal042_ << std::endl;
-    // std::cout << "signal043_" << std::hex << my_module->signal043_ << std::endl;
-    // std::cout << "signal044_" << std::hex << my_module->signal044_ << std::endl;
-    // std::cout << "signal045_" << std::hex << my_module->signal045_ << std::endl;
-    // std::cout << "signal046_" << std::hex << my_module->signal046_ << std::endl;
-    // std::cout << "signal047_" << std::hex << my_module->signal047_ << std::endl;
-    // std::cout << "signal048_" << std::hex << my_module->signal048_ << std::endl;
-    // std::cout << "signal049_" << std::hex << my_module->signal049_ << std::endl;
-    // std::cout << "signal050_" << std::hex << my_module->signal050_ << std::endl;
-    // std::cout << "signal051_" << std::hex << my_module->signal051_ << std::endl;
-    // std::cout << "signal052_" << std::hex << my_module->signal052_ << std::endl;
-    // std::cout << "signal053_" << std::hex << my_module->signal053_ << std::endl;
-    // std::cout << "signal054_" << std::hex << my_module->signal054_ << std::endl;
-    // std::cout << "signal055_" << std::hex << my_module->signal055_ << std::endl;
-    // std::cout << "signal056_" << std::hex << my_module->signal056_ << std::endl;
-    // std::cout << "signal057_" << std::hex << my_module->signal057_ << std::endl;
-    // std::cout << "signal058_" << std::hex << my_module->signal058_ << std::endl;
-    // std::cout << "signal059_" << std::hex << my_module->signal059_ << std::endl;
-    // std::cout << "signal060_" << std::hex << my_module->signal060_ << std::endl;
-    // std::cout << "signal061_" << std::hex << my_module->signal061_ << std::endl;
-    // std::cout << "signal062_" << std::hex << my_module->signal062_ << std::endl;
-    // std::cout << "signal063_" << std::hex << my_module->signal063_ << std::endl;
-    // std::cout << "signal064_" << std::hex << my_module->signal064_ << std::endl;
-    // std::cout << "signal065_" << std::hex << my_module->signal065_ << std::endl;
-    // std::cout << "signal066_" << std::hex << my_module->signal066_ << std::endl;
-    // std::cout << "signal067_" << std::hex << my_module->signal067_ << std::endl;
-    // std::cout << "signal068_" << std::hex << my_module->signal068_ << std::endl;
-    // std::cout << "signal069_" << std::hex << my_module->signal069_ << std::endl;
-    // std::cout << "signal070_" << std::hex << my_module->signal070_ << std::endl;
-    // std::cout << "signal071_" << std::hex << my_module->signal071_ << std::endl;
-    // std::cout << "signal111_" << std::hex << my_module->signal111_ << std::endl;
-    // std::cout << "signal124_" << std::hex << my_module->signal124_ << std::endl;
-    // std::cout << "signal129_" << std::hex << my_module->signal129_ << std::endl;
-    // std::cout << "signal115_" << std::hex << my_module->signal115_ << std::endl;
-    // std::cout << "signal116_" << std::hex << my_module->signal116_ << std::endl;
-    // std::cout << "signal109_" << std::hex << my_module->signal109_ << std::endl;
-    // std::cout << "signal075_" << std::hex << my_module->signal075_ << std::endl;
-    // std::cout << "signal076_" << std::hex << my_module->signal076_ << std::endl;
-    // std::cout << "signal077_" << std::hex << my_module->signal077_ << std::endl;
-    // std::cout << "signal122_" << std::hex << my_module->signal122_ << std::endl;
-    // std::cout << "signal123_" << std::hex << my_module->signal123_ << std::endl;
-    // std::cout << "signal091_" << std::hex << my_module->signal091_ << std::endl;
-    // std::cout << "signal112_" << std::hex << my_module->signal112_ << std::endl;
-    // std::cout << "signal132_" << std::hex << my_module->signal132_ << std::endl;
-    // std::cout << "signal146_" << std::hex << my_module->signal146_ << std::endl;
-    // std::cout << "signal166_" << std::hex << my_module->signal166_ << std::endl;
-    // std::cout << "signal176_" << std::hex << my_module->signal176_ << std::endl;
-    // std::cout << "signal113_" << std::hex << my_module->signal113_ << std::endl;
-    // std::cout << "signal114_" << std::hex << my_module->signal114_ << std::endl;
-    // std::cout << "signal121_" << std::hex << my_module->signal121_ << std::endl;
-    // std::cout << "signal095_" << std::hex << my_module->signal095_ << std::endl;
-    // std::cout << "signal096_" << std::hex << my_module->signal096_ << std::endl;
-    // std::cout << "signal097_" << std::hex << my_module->signal097_ << std::endl;
-    // std::cout << "signal080_" << std::hex << my_module->signal080_ << std::endl;
-    // std::cout << "signal081_" << std::hex << my_module->signal081_ << std::endl;
-    // std::cout << "signal082_" << std::hex << my_module->signal082_ << std::endl;
-    // std::cout << "signal088_" << std::hex << my_module->signal088_ << std::endl;
-    // std::cout << "signal145_" << std::hex << my_module->signal145_ << std::endl;
-    // std::cout << "signal089_" << std::hex << my_module->signal089_ << std::endl;
-    // std::cout << "signal090_" << std::hex << my_module->signal090_ << std::endl;
-
-    // for (int i = 0; i < 72/32  + 1; i++)
-    //   std::cout << "signal083_ " << i << " " << std::hex << my_module->signal083_[i] << std::endl;
-    // for (int i = 0; i < 72/32  + 1; i++)
-    //   std::cout << "signal084_ " << i << " " << std::hex << my_module->signal084_[i] << std::endl;
-    // for (int i = 0; i < 77/32  + 1; i++)
-    //   std::cout << "signal139_ " << i << " " << std::hex << my_module->signal139_[i] << std::endl;
-    // for (int i = 0; i < 78/32  + 1; i++)
-    //   std::cout << "signal156_ " << i << " " << std::hex << my_module->signal156_[i] << std::endl;
-    // for (int i = 0; i < 81/32  + 1; i++)
-    //   std::cout << "signal098_ " << i << " " << std::hex << my_module->signal098_[i] << std::endl;
-    // for (int i = 0; i < 81/32  + 1; i++)
-    //   std::cout << "signal099_ " << i << " " << std::hex << my_module->signal099_[i] << std::endl;
-    // for (int i = 0; i < 82/32  + 1; i++)
-    //   std::cout << "signal171_ " << i << " " << std::hex << my_module->signal171_[i] << std::endl;
-    // for (int i = 0; i < 83/32  + 1; i++)
-    //   std::cout << "signal148_ " << i << " " << std::hex << my_module->signal148_[i] << std::endl;
-    // for (int i = 0; i < 86/32  + 1; i++)
-    //   std::cout << "signal173_ " << i << " " << std::hex << my_module->signal173_[i] << std::endl;
-    // for (int i = 0; i < 88/32  + 1; i++)
-    //   std::cout << "signal110_ " << i << " " << std::hex << my_module->signal110_[i] << std::endl;
-    // for (int i = 0; i < 109/32 + 1; i++)
-    //   std::cout << "signal125_ " << i << " " << std::hex << my_module->signal125_[i] << std::endl;
-    // for (int i = 0; i < 109/32 + 1; i++)
-    //   std::cout << "signal126_ " << i << " " << std::hex << my_module->signal126_[i] << std::endl;
-    // for (int i = 0; i < 124/32 + 1; i++)
-    //   std::cout << "signal159_ " << i << " " << std::hex << my_module->signal159_[i] << std::endl;
-    // for (int i = 0; i < 130/32 + 1; i++)
-    //   std::cout << "signal137_ " << i << " " << std::hex << my_module->signal137_[i] << std::endl;
-    // for (int i = 0; i < 142/32 + 1; i++)
-    //   std::cout << "signal158_ " << i << " " << std::hex << my_module->signal158_[i] << std::endl;
-    // for (int i = 0; i < 144/32 + 1; i++)
-    //   std::cout << "signal138_ " << i << " " << std::hex << my_module->signal138_[i] << std::endl;
-    // for (int i = 0; i < 144/32 + 1; i++)
-    //   std::cout << "signal182_ " << i << " " << std::hex << my_module->signal182_[i] << std::endl;
-    // for (int i = 0; i < 146/32 + 1; i++)
-    //   std::cout << "signal180_ " << i << " " << std::hex << my_module->signal180_[i] << std::endl;
-    // for (int i = 0; i < 152/32 + 1; i++)
-    //   std::cout << "signal174_ " << i << " " << std::hex << my_module->signal174_[i] << std::endl;
-    // for (int i = 0; i < 157/32 + 1; i++)
-    //   std::cout << "signal181_ " << i << " " << std::hex << my_module->signal181_[i] << std::endl;
-    // for (int i = 0; i < 171/32 + 1; i++)
-    //   std::cout << "signal168_ " << i << " " << std::hex << my_module->signal168_[i] << std::endl;
-    // for (int i = 0; i < 174/32 + 1; i++)
-    //   std::cout << "signal107_ " << i << " " << std::hex << my_module->signal107_[i] << std::endl;
-    // for (int i = 0; i < 174/32 + 1; i++)
-    //   std::cout << "signal108_ " << i << " " << std::hex << my_module->signal108_[i] << std::endl;
-    // for (int i = 0; i < 176/32 + 1; i++)
-    //   std::cout << "signal133_ " << i << " " << std::hex << my_module->signal133_[i] << std::endl;
-    // for (int i = 0; i < 180/32 + 1; i++)
-    //   std::cout << "signal154_ " << i << " " << std::hex << my_module->signal154_[i] << std::endl;
-    // for (int i = 0; i < 187/32 + 1; i++)
-    //   std::cout << "signal150_ " << i << " " << std::hex << my_module->signal150_[i] << std::endl;
-    // for (int i = 0; i < 193/32 + 1; i++)
-    //   std::cout << "signal134_ " << i << " " << std::hex << my_module->signal134_[i] << std::endl;
-    // for (int i = 0; i < 200/32 + 1; i++)
-    //   std::cout << "signal100_ " << i << " " << std::hex << my_module->signal100_[i] << std::endl;
-    // for (int i = 0; i < 200/32 + 1; i++)
-    //   std::cout << "signal101_ " << i << " " << std::hex << my_module->signal101_[i] << std::endl;
-    // for (int i = 0; i < 200/32 + 1; i++)
-    //   std::cout << "signal102_ " << i << " " << std::hex << my_module->signal102_[i] << std::endl;
-    // for (int i = 0; i < 201/32 + 1; i++)
-    //   std::cout << "signal169_ " << i << " " << std::hex << my_module->signal169_[i] << std::endl;
-    // for (int i = 0; i < 205/32 + 1; i++)
-    //   std::cout << "signal117_ " << i << " " << std::hex << my_module->signal117_[i] << std::endl;
-    // for (int i = 0; i < 205/32 + 1; i++)
-    //   std::cout << "signal118_ " << i << " " << std::hex << my_module->signal118_[i] << std::endl;
-    // for (int i = 0; i < 206/32 + 1; i++)
-    //   std::cout << "signal183_ " << i << " " << std::hex << my_module->signal183_[i] << std::endl;
-    // for (int i = 0; i < 214/32 + 1; i++)
-    //   std::cout << "signal179_ " << i << " " << std::hex << my_module->signal179_[i] << std::endl;
-    // for (int i = 0; i < 218/32 + 1; i++)
-    //   std::cout << "signal184_ " << i << " " << std::hex << my_module->signal184_[i] << std::endl;
-    // for (int i = 0; i < 219/32 + 1; i++)
-    //   std::cout << "signal105_ " << i << " " << std::hex << my_module->signal105_[i] << std::endl;
-    // for (int i = 0; i < 219/32 + 1; i++)
-    //   std::cout << "signal106_ " << i << " " << std::hex << my_module->signal106_[i] << std::endl;
-    // for (int i = 0; i < 223/32 + 1; i++)
-    //   std::cout << "signal119_ " << i << " " << std::hex << my_module->signal119_[i] << std::endl;
-    // for (int i = 0; i < 223/32 + 1; i++)
-    //   std::cout << "signal120_ " << i << " " << std::hex << my_module->signal120_[i] << std::endl;
-    // for (int i = 0; i < 223/32 + 1; i++)
-    //   std::cout << "signal135_ " << i << " " << std::hex << my_module->signal135_[i] << std::endl;
-    // for (int i = 0; i < 223/32 + 1; i++)
-    //   std::cout << "signal136_ " << i << " " << std::hex << my_module->signal136_[i] << std::endl;
-    // for (int i = 0; i < 224/32 + 1; i++)
-    //   std::cout << "signal162_ " << i << " " << std::hex << my_module->signal162_[i] << std::endl;
-    // for (int i = 0; i < 224/32 + 1; i++)
-    //   std::cout << "signal163_ " << i << " " << std::hex << my_module->signal163_[i] << std::endl;
-    // for (int i = 0; i < 225/32 + 1; i++)
-    //   std::cout << "signal144_ " << i << " " << std::hex << my_module->signal144_[i] << std::endl;
-    // for (int i = 0; i < 229/32 + 1; i++)
-    //   std::cout << "signal130_ " << i << " " << std::hex << my_module->signal130_[i] << std::endl;
-    // for (int i = 0; i < 229/32 + 1; i++)
-    //   std::cout << "signal131_ " << i << " " << std::hex << my_module->signal131_[i] << std::endl;
-    // for (int i = 0; i < 235/32 + 1; i++)
-    //   std::cout << "signal178_ " << i << " " << std::hex << my_module->signal178_[i] << std::endl;
-    // for (int i = 0; i < 238/32 + 1; i++)
-    //   std::cout << "signal078_ " << i << " " << std::hex << my_module->signal078_[i] << std::endl;
-    // for (int i = 0; i < 238/32 + 1; i++)
-    //   std::cout << "signal079_ " << i << " " << std::hex << my_module->signal079_[i] << std::endl;
-    // for (int i = 0; i < 240/32 + 1; i++)
-    //   std::cout << "signal157_ " << i << " " << std::hex << my_module->signal157_[i] << std::endl;
-    // for (int i = 0; i < 247/32 + 1; i++)
-    //   std::cout << "signal172_ " << i << " " << std::hex << my_module->signal172_[i] << std::endl;
-    // for (int i = 0; i < 247/32 + 1; i++)
-    //   std::cout << "signal175_ " << i << " " << std::hex << my_module->signal175_[i] << std::endl;
-    // for (int i = 0; i < 259/32 + 1; i++)
-    //   std::cout << "signal092_ " << i << " " << std::hex << my_module->signal092_[i] << std::endl;
-    // for (int i = 0; i < 259/32 + 1; i++)
-    //   std::cout << "signal093_ " << i << " " << std::hex << my_module->signal093_[i] << std::endl;
-    // for (int i = 0; i < 259/32 + 1; i++)
-    //   std::cout << "signal094_ " << i << " " << std::hex << my_module->signal094_[i] << std::endl;
-    // for (int i = 0; i < 259/32 + 1; i++)
-    //   std::cout << "signal140_ " << i << " " << std::hex << my_module->signal140_[i] << std::endl;
-    // for (int i = 0; i < 262/32 + 1; i++)
-    //   std::cout << "signal164_ " << i << " " << std::hex << my_module->signal164_[i] << std::endl;
-    // for (int i = 0; i < 262/32 + 1; i++)
-    //   std::cout << "signal165_ " << i << " " << std::hex << my_module->signal165_[i] << std::endl;
-    // for (int i = 0; i < 271/32 + 1; i++)
-    //   std::cout << "signal149_ " << i << " " << std::hex << my_module->signal149_[i] << std::endl;
-    // for (int i = 0; i < 271/32 + 1; i++)
-    //   std::cout << "signal155_ " << i << " " << std::hex << my_module->signal155_[i] << std::endl;
-    // for (int i = 0; i < 273/32 + 1; i++)
-    //   std::cout << "signal160_ " << i << " " << std::hex << my_module->signal160_[i] << std::endl;
-    // for (int i = 0; i < 273/32 + 1; i++)
-    //   std::cout << "signal161_ " << i << " " << std::hex << my_module->signal161_[i] << std::endl;
-    // for (int i = 0; i < 274/32 + 1; i++)
-    //   std::cout << "signal167_ " << i << " " << std::hex << my_module->signal167_[i] << std::endl;
-    // for (int i = 0; i < 275/32 + 1; i++)
-    //   std::cout << "signal143_ " << i << " " << std::hex << my_module->signal143_[i] << std::endl;
-    // for (int i = 0; i < 281/32 + 1; i++)
-    //   std::cout << "signal072_ " << i << " " << std::hex << my_module->signal072_[i] << std::endl;
-    // for (int i = 0; i < 281/32 + 1; i++)
-    //   std::cout << "signal073_ " << i << " " << std::hex << my_module->signal073_[i] << std::endl;
-    // for (int i = 0; i < 281/32 + 1; i++)
-    //   std::cout << "signal074_ " << i << " " << std::hex << my_module->signal074_[i] << std::endl;
-    // for (int i = 0; i < 282/32 + 1; i++)
-    //   std::cout << "signal151_ " << i << " " << std::hex << my_module->signal151_[i] << std::endl;
-    // for (int i = 0; i < 282/32 + 1; i++)
-    //   std::cout << "signal152_ " << i << " " << std::hex << my_module->signal152_[i] << std::endl;
-    // for (int i = 0; i < 282/32 + 1; i++)
-    //   std::cout << "signal153_ " << i << " " << std::hex << my_module->signal153_[i] << std::endl;
-    // for (int i = 0; i < 289/32 + 1; i++)
-    //   std::cout << "signal147_ " << i << " " << std::hex << my_module->signal147_[i] << std::endl;
-    // for (int i = 0; i < 289/32 + 1; i++)
-    //   std::cout << "signal170_ " << i << " " << std::hex << my_module->signal170_[i] << std::endl;
-    // for (int i = 0; i < 291/32 + 1; i++)
-    //   std::cout << "signal185_ " << i << " " << std::hex << my_module->signal185_[i] << std::endl;
-    // // for (int i = 0; i < 291/32 + 1; i++)
-    // //   std::cout << "signal186_ " << i << " " << std::hex << my_module->signal186_[i] << std::endl;
-    // for (int i = 0; i < 295/32 + 1; i++)
-    //   std::cout << "signal177_ " << i << " " << std::hex << my_module->signal177_[i] << std::endl;
-    // for (int i = 0; i < 296/32 + 1; i++)
-    //   std::cout << "signal103_ " << i << " " << std::hex << my_module->signal103_[i] << std::endl;
-    // for (int i = 0; i < 296/32 + 1; i++)
-    //   std::cout << "signal104_ " << i << " " << std::hex << my_module->signal104_[i] << std::endl;
-    // for (int i = 0; i < 298/32 + 1; i++)
-    //   std::cout << "signal127_ " << i << " " << std::hex << my_module->signal127_[i] << std::endl;
-    // for (int i = 0; i < 298/32 + 1; i++)
-    //   std::cout << "signal128_ " << i << " " << std::hex << my_module->signal128_[i] << std::endl;
-    // for (int i = 0; i < 299/32 + 1; i++)
-    //   std::cout << "signal085_ " << i << " " << std::hex << my_module->signal085_[i] << std::endl;
-    // for (int i = 0; i < 299/32 + 1; i++)
-    //   std::cout << "signal086_ " << i << " " << std::hex << my_module->signal086_[i] << std::endl;
-    // for (int i = 0; i < 299/32 + 1; i++)
-    //   std::cout << "signal087_ " << i << " " << std::hex << my_module->signal087_[i] << std::endl;
-    // for (int i = 0; i < 299/32 + 1; i++)
-    //   std::cout << "signal141_ " << i << " " << std::hex << my_module->signal141_[i] << std::endl;
-    // for (int i = 0; i < 299/32 + 1; i++)
-    //   std::cout << "signal142_ " << i << " " << std::hex << my_module->signal142_[i] << std::endl;
+    if (probes != NULL && tick_id >= trace_from) {
+      probe_writer_push(*probes);
+      tick_stats_lap(tick_stats, TICK_PHASE_PROBES, &lap);
+    }
+    tick_stats_lap(tick_stats, TICK_PHASE_TICK, &tick_start);
   }
 
 #if VM_TRACE
-      trace_->flush();
+  close_trace();
 #endif // VM_TRACE
+  digest_writer_flush(digests);
+  output_digest = digests.chain;
+  release_memo_table(memo);
+  if (probes != NULL) {
+    probe_writer_flush(*probes);
+    delete probes;
+  }
+
+  auto stop = std::chrono::steady_clock::now();
+  long ret = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+  return std::make_pair(ret, cumulated_output);
+}
+
+/**
+ * Runs the ticks [tick_begin, tick_end) without tracing.
+ * As top is purely combinational, a tick only depends on its own input vector.
+ *
+ * @param my_module a pointer to a module instance owned by the calling thread
+ * @param stimulus the stimulus covering at least tick_end ticks
+ * @param digests the digest writer of these ticks, flushed on return
+ * @param stats the latency histograms of the calling thread, or NULL
+ * @param coverage the toggle coverage of the calling thread, set up on my_module, or NULL
+ * @param memo the memoization table of my_module, or NULL
+ * @param probes the probe writer of these ticks on my_module, flushed on return, or NULL
+ * @return the sum of the output words over these ticks
+ */
+uint64_t run_tick_range(Module *my_module, const Stimulus *stimulus, int tick_begin, int tick_end, DigestWriter &digests, TickStats *stats, ToggleCoverage *coverage, MemoTable *memo, ProbeWriter *probes) {
+  uint64_t cumulated_output = 0;
+  StimulusCursor curr_id_in_random_inputs_from_file(stimulus, (size_t) (tick_begin > 0 && coverage != NULL ? tick_begin - 1 : tick_begin) * NUM_RANDOM_INPUTS_PER_TICK);
+
+  if (tick_begin > 0 && coverage != NULL) {
+    // Prime the coverage with the previous tick, so that the toggles into tick_begin count as in a single-threaded run.
+    randomize_inputs(my_module, curr_id_in_random_inputs_from_file);
+    my_module->eval();
+    coverage_sample(*coverage);
+  }
+
+  for (int tick_id = tick_begin; tick_id < tick_end; tick_id++) {
+    uint64_t tick_start = tick_stats_start(stats);
+    uint64_t lap = tick_start;
+    randomize_inputs(my_module, curr_id_in_random_inputs_from_file);
+    tick_stats_lap(stats, TICK_PHASE_RANDOMIZE_INPUTS, &lap);
+    TbHarness::eval_memoized(my_module, memo);
+    tick_stats_lap(stats, TICK_PHASE_EVAL, &lap);
+
+    cumulated_output += TbHarness::accumulate_outputs(my_module, digests);
+    tick_stats_lap(stats, TICK_PHASE_ACCUMULATE_OUTPUTS, &lap);
+    if (coverage != NULL) {
+      coverage_sample(*coverage);
+      tick_stats_lap(stats, TICK_PHASE_COVERAGE, &lap);
+    }
+    if (probes != NULL) {
+      probe_writer_push(*probes);
+      tick_stats_lap(stats, TICK_PHASE_PROBES, &lap);
+    }
+    tick_stats_lap(stats, TICK_PHASE_TICK, &tick_start);
+  }
+  digest_writer_flush(digests);
+  if (probes != NULL)
+    probe_writer_flush(*probes);
+  return cumulated_output;
+}
+
+/**
+ * Runs the testbench by splitting [0, simlen) into contiguous shards, one per thread.
+ * Each shard owns its own context and module. The output signature is the same as run_test's.
+ *
+ * @param simlen the number of cycles to run
+ * @param num_threads the number of worker threads, at most simlen
+ */
+std::pair<long, uint64_t> run_test_sharded(int simlen, int num_threads) {
+  std::vector<uint64_t> shard_outputs(num_threads, 0);
+  std::vector<DigestWriter> shard_digests;
+  shard_digests.reserve(num_threads);
+  std::vector<TickStats> shard_stats(tick_stats == NULL ? 0 : num_threads);
+  std::vector<ToggleCoverage> shard_coverages(toggle_coverage == NULL ? 0 : num_threads);
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+
+  // The workers only construct their models once they are all spawned, so that none of them is seen as a model thread.
+  std::unique_lock<std::mutex> spawn_lock(model_construction_mutex);
+  for (int shard_id = 0; shard_id < num_threads; shard_id++) {
+    int tick_begin = (int) ((int64_t) simlen * shard_id / num_threads);
+    int tick_end = (int) ((int64_t) simlen * (shard_id + 1) / num_threads);
+    shard_digests.emplace_back(digest_log_fd, tick_begin);
+    DigestWriter &digests = shard_digests.back();
+    TickStats *stats = tick_stats == NULL ? NULL : &shard_stats[shard_id];
+    ToggleCoverage *coverage = toggle_coverage == NULL ? NULL : &shard_coverages[shard_id];
+    workers.emplace_back([&shard_outputs, &digests, stats, coverage, shard_id, tick_begin, tick_end]() {
+      // Construct the module on its worker thread so that its memory is local to it.
+      // With CPUS, each shard gets its own slice of max(eval_threads, 1) CPUs.
+      std::vector<int> shard_cpus;
+      int shard_num_cpus = std::max(eval_threads, 1);
+      for (int i = 0; i < shard_num_cpus && !sim_cpus.empty(); i++)
+        shard_cpus.push_back(sim_cpus[(shard_id * shard_num_cpus + i) % sim_cpus.size()]);
+      VerilatedContext shard_context;
+      std::vector<pid_t> model_tids;
+      Module *shard_module = construct_module(&shard_context, shard_cpus, &model_tids);
+      if (coverage != NULL)
+        setup_coverage(*coverage, shard_module);
+      MemoTable *memo = create_memo_table();
+      ProbeWriter *probes = create_probe_writer(shard_module, tick_begin);
+      std::vector<ThreadCpuTime> start_times = thread_cpu_times(model_tids);
+      shard_outputs[shard_id] = run_tick_range(shard_module, &random_inputs_from_file, tick_begin, tick_end, digests, stats, coverage, memo, probes);
+      record_thread_times(model_tids, start_times);
+      release_memo_table(memo);
+      delete probes;
+      delete shard_module;
+    });
+  }
+  spawn_lock.unlock();
+
+  uint64_t cumulated_output = 0;
+  output_digest = DIGEST_SEED;
+  for (int shard_id = 0; shard_id < num_threads; shard_id++) {
+    workers[shard_id].join();
+    cumulated_output += shard_outputs[shard_id];
+    output_digest = digest_chain_append(output_digest, shard_digests[shard_id]);
+    if (tick_stats != NULL)
+      tick_stats_merge(*tick_stats, shard_stats[shard_id]);
+    if (toggle_coverage != NULL) {
+      // The shard coverages point into the shard modules, which are gone, so only keep their bitmaps.
+      if (shard_id == 0)
+        *toggle_coverage = shard_coverages[0];
+      else
+        coverage_merge(*toggle_coverage, shard_coverages[shard_id]);
+    }
+  }
 
   auto stop = std::chrono::steady_clock::now();
-  long ret = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+  long ret = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
   return std::make_pair(ret, cumulated_output);
 }
 
+/**
+ * Brings the module back to its initial state between two server jobs.
+ * top has no state, so driving all-zero inputs is enough.
+ */
+void reset_module(Module *my_module) {
+  TbHarness::reset_inputs(my_module);
+  my_module->eval();
+}
+
+/**
+ * Runs one server job and writes its answer line.
+ * A job is "<simlen> [<binary stimulus file> | seed=<seed>]". Without either, PATH_TO_RANDOM_INPUTS_FILE is read as text.
+ * With a seed, the stimulus is generated in process in the STIM_MODE of the server.
+ * The answer is "<output signature> <elapsed ns>", or "error <reason>".
+ * The memoization table, if any, is kept across jobs.
+ */
+void serve_job(Module *my_module, MemoTable *memo, const char *job_line, FILE *out) {
+  int simlen = 0;
+  char stimulus_path[4096] = "";
+  if (sscanf(job_line, "%d %4095s", &simlen, stimulus_path) < 1 || simlen <= 0) {
+    fprintf(out, "error malformed job\n");
+    return;
+  }
+
+  Stimulus job_stimulus;
+  unsigned long long seed;
+  bool loaded;
+  if (sscanf(stimulus_path, "seed=%llu", &seed) == 1)
+    loaded = stimulus_init_generator(&job_stimulus, cl_get_stim_mode(FULL_RANDOM), seed, cl_get_stim_flips(), NUM_RANDOM_INPUTS_PER_TICK, simlen);
+  else if (stimulus_path[0] == '\0')
+    loaded = stimulus_load_text(&job_stimulus, PATH_TO_RANDOM_INPUTS_FILE, (size_t) simlen * NUM_RANDOM_INPUTS_PER_TICK);
+  else
+    loaded = stimulus_open_binary(&job_stimulus, stimulus_path, false, IN_DATA_WIDTH, NUM_RANDOM_INPUTS_PER_TICK, simlen);
+  if (!loaded) {
+    stimulus_close(&job_stimulus);
+    fprintf(out, "error could not load the stimulus\n");
+    return;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  reset_module(my_module);
+  DigestWriter digests(-1, 0);
+  uint64_t verify_mismatches_before = memo == NULL ? 0 : memo->stats.verify_mismatches;
+  uint64_t cumulated_output = run_tick_range(my_module, &job_stimulus, 0, simlen, digests, NULL, NULL, memo, NULL);
+  auto stop = std::chrono::steady_clock::now();
+  long long elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+
+  uint64_t verify_mismatches = memo == NULL ? 0 : memo->stats.verify_mismatches - verify_mismatches_before;
+  if (verify_mismatches > 0)
+    fprintf(out, "error the memoized outputs of %llu ticks differ from the model\n", (unsigned long long) verify_mismatches);
+  else
+    fprintf(out, "%llu %lld\n", (unsigned long long) cumulated_output, elapsed_ns);
+  stimulus_close(&job_stimulus);
+}
+
+/**
+ * Serves the job lines of one client until it disconnects.
+ *
+ * @return true if the client asked the server to quit
+ */
+bool serve_client(Module *my_module, MemoTable *memo, FILE *in, FILE *out) {
+  char *job_line = NULL;
+  size_t job_line_capacity = 0;
+  bool quit = false;
+  while (!quit && getline(&job_line, &job_line_capacity, in) > 0) {
+    // Compare the whole first token, so that a line such as "quitting" is served as a (malformed) job.
+    if (strcspn(job_line, " \t\r\n") == 4 && !strncmp(job_line, "quit", 4))
+      quit = true;
+    else
+      serve_job(my_module, memo, job_line, out);
+    fflush(out);
+  }
+  free(job_line);
+  return quit;
+}
+
+/**
+ * Serves jobs on a single long-lived module, over stdin/stdout if socket_path is "-" and over a Unix socket otherwise.
+ * Jobs are never traced.
+ */
+void run_server(Module *my_module, MemoTable *memo, const char *socket_path) {
+  if (!strcmp(socket_path, "-")) {
+    serve_client(my_module, memo, stdin, stdout);
+    return;
+  }
+
+  // A client that disconnects before reading its answers must not kill the server.
+  signal(SIGPIPE, SIG_IGN);
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+  unlink(socket_path);
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_fd < 0 || bind(listen_fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+    std::cerr << "Could not listen on " << socket_path << "." << std::endl;
+    exit(1);
+  }
+  std::cerr << "Serving jobs on " << socket_path << "." << std::endl;
+
+  bool quit = false;
+  while (!quit) {
+    int client_fd = accept(listen_fd, NULL, NULL);
+    if (client_fd < 0)
+      continue;
+    FILE *in = fdopen(client_fd, "r");
+    int out_fd = in == NULL ? -1 : dup(client_fd);
+    FILE *out = out_fd < 0 ? NULL : fdopen(out_fd, "w");
+    if (out == NULL) {
+      // Drop this client, but keep serving the others.
+      std::cerr << "Could not open the streams of a client." << std::endl;
+      if (out_fd >= 0)
+        close(out_fd);
+      if (in != NULL)
+        fclose(in);
+      else
+        close(client_fd);
+      continue;
+    }
+    quit = serve_client(my_module, memo, in, out);
+    fclose(in);
+    fclose(out);
+  }
+
+  close(listen_fd);
+  unlink(socket_path);
+}
+
 int main(int argc, char **argv, char **env) {
 
   Verilated::commandArgs(argc, argv);
   Verilated::traceEverOn(VM_TRACE);
+  memo_entries = cl_get_memo_entries();
+  memo_verify = cl_get_memo_verify();
+
+  ////////
+  // In server mode, the simulation length and stimulus come with each job.
+  ////////
+
+  const char *server_socket = cl_get_server_socket();
+  if (server_socket != NULL) {
+    // The server is long-lived, so it is where pinning the model threads matters most.
+    eval_threads = cl_get_eval_threads(std::cerr);
+    if (!cl_get_sim_cpus(sim_cpus))
+      exit(1);
+    VerilatedContext *contextp = new VerilatedContext;
+    contextp->commandArgs(argc, argv);
+    std::vector<pid_t> model_tids;
+    Module *my_module = construct_module(contextp, sim_cpus, &model_tids);
+    MemoTable *memo = create_memo_table();
+    std::vector<ThreadCpuTime> start_times = thread_cpu_times(model_tids);
+    run_server(my_module, memo, server_socket);
+    record_thread_times(model_tids, start_times);
+    release_memo_table(memo);
+    // Standard output may carry the answers, so report on standard error.
+    if (sim_thread_times.size() > 1)
+      thread_cpu_times_print(std::cerr, sim_thread_times);
+    if (memo_entries > 0)
+      memo_stats_print(std::cerr, memo_stats, memo_verify);
+    delete my_module;
+    delete contextp;
+    exit(memo_stats.verify_mismatches > 0 ? 1 : 0);
+  }
 
   ////////
   // Get the env vars early to avoid Verilator segfaults.
@@ -394,27 +672,138 @@ int main(int argc, char **argv, char **env) {
 
   std::cout << "Starting getting env variables." << std::endl;
   int simlen = get_sim_length_cycles(0);
+  int num_threads = get_num_sim_threads(simlen);
   read_random_inputs_from_file(simlen);
   std::string vcd_filepath = cl_get_tracefile();
+  const char *digest_filepath = cl_get_digestfile();
 
-  ////////
-  // Instantiate the module.
-  ////////
+  checkpoint_every = cl_get_checkpoint_every();
+  checkpoint_dir = cl_get_checkpoint_dir();
+  cl_get_trace_window(simlen, &trace_from, &trace_to);
+  if (checkpoint_every > 0 && !checkpoint_create_dir(checkpoint_dir))
+    exit(1);
+
+#if VM_TRACE
+  if (num_threads > 1) { std::cerr << "SIMTHREADS > 1 is not supported with tracing." << std::endl; exit(1); }
+  // The asynchronous trace reads the internal signals from the model, so it needs all of them in probe_table.h.
+  if (cl_get_trace_async() && probe_table(NULL).empty()) { std::cerr << "TRACE_ASYNC requires probe_table.h, generated by gen_probe_table.py, and a build with --public-flat-rw." << std::endl; exit(1); }
+#else
+  if (trace_from > 0 || trace_to >= 0) { std::cerr << "TRACE_FROM and TRACE_TO require a traced build." << std::endl; exit(1); }
+#endif // VM_TRACE
+  // A resumed run does not write the digests of the ticks before its checkpoint, and TRACE_TO stops the run early.
+  if (digest_filepath != NULL && (trace_from > 0 || trace_to >= 0)) { std::cerr << "DIGESTFILE is not supported with TRACE_FROM and TRACE_TO." << std::endl; exit(1); }
+  if (digest_filepath != NULL && (digest_log_fd = digest_log_create(digest_filepath, OUT_DATA_WIDTH, simlen)) < 0)
+    exit(1);
+#if VM_TRACE
+  // Memoized ticks skip eval(), so the traced internal signals would be stale.
+  if (memo_entries > 0) { std::cerr << "MEMO_ENTRIES requires an untraced build." << std::endl; exit(1); }
+#endif // VM_TRACE
+  if (num_threads > 1 && checkpoint_every > 0) { std::cerr << "SIMTHREADS > 1 is not supported with checkpoints." << std::endl; exit(1); }
 
-  Module *my_module = new Module;
+  eval_threads = cl_get_eval_threads(std::cout);
+  if (!cl_get_sim_cpus(sim_cpus))
+    exit(1);
 
-  ////////
-  // Run the experiment.
-  ////////
+  const char *coverage_filepath = cl_get_coverage_file();
+  int afl_shm_id = cl_get_afl_shm_id();
+  uint64_t afl_map_size = afl_shm_id >= 0 ? cl_get_afl_map_size(COVERAGE_AFL_DEFAULT_MAP_SIZE) : 0;
+  if (coverage_filepath != NULL || afl_shm_id >= 0)
+    toggle_coverage = new ToggleCoverage;
+  if (toggle_coverage != NULL && memo_entries > 0) { std::cerr << "MEMO_ENTRIES is not supported with toggle coverage." << std::endl; exit(1); }
+
+  const char *probe_patterns = cl_get_probes();
+  if (probe_patterns != NULL) {
+    if (memo_entries > 0) { std::cerr << "MEMO_ENTRIES is not supported with PROBES." << std::endl; exit(1); }
+    std::vector<ProbeSignal> table = probe_table(NULL);
+    if (!probe_select(table, probe_patterns, probe_ids))
+      exit(1);
+    probe_first_tick = trace_from;
+    int probe_last_tick = trace_to < 0 ? simlen : trace_to;
+    if ((probe_fd = probe_file_create(cl_get_probefile(), probe_bind(table, probe_ids), probe_first_tick, probe_last_tick - probe_first_tick, &probe_records_offset)) < 0)
+      exit(1);
+  }
+
+  const char *stats_filepath = cl_get_statsfile();
+  double cycles_per_ns = 1.0;
+  if (stats_filepath != NULL) {
+    tick_stats = new TickStats;
+    cycles_per_ns = tick_stats_calibrate();
+  }
+
+  std::pair<long, uint64_t> duration_and_output;
+  if (num_threads > 1) {
+    ////////
+    // Run the experiment, each worker thread instantiates its own module.
+    ////////
+
+    duration_and_output = run_test_sharded(simlen, num_threads);
+  } else {
+    ////////
+    // Instantiate the module.
+    ////////
 
-  std::pair<long, uint64_t> duration_and_output = run_test(my_module, simlen, vcd_filepath);
-  long duration = duration_and_output.first;
+    VerilatedContext *contextp = new VerilatedContext;
+    contextp->commandArgs(argc, argv);
+    contextp->traceEverOn(VM_TRACE);
+    std::vector<pid_t> model_tids;
+    Module *my_module = construct_module(contextp, sim_cpus, &model_tids);
+#if VM_TRACE
+    // The asynchronous trace writer gets the CPU of the list after those of the model.
+    if (!sim_cpus.empty())
+      trace_writer_cpu = sim_cpus[model_tids.size() % sim_cpus.size()];
+#endif // VM_TRACE
+
+    ////////
+    // Run the experiment.
+    ////////
+
+    std::vector<ThreadCpuTime> start_times = thread_cpu_times(model_tids);
+    duration_and_output = run_test(my_module, simlen, vcd_filepath);
+    record_thread_times(model_tids, start_times);
+    delete my_module;
+    delete contextp;
+  }
+  long duration_ns = duration_and_output.first;
+  long duration = duration_ns / 1000000;
   uint64_t cumulated_output = duration_and_output.second;
 
   std::cout << "Testbench complete!" << std::endl;
-  std::cout << "Output signature: " << std::dec << cumulated_output << "." << std::endl;
+  if (trace_to >= 0 && trace_to < simlen) {
+    // The run stopped at the end of the traced window, so its results must not be compared with those of full runs.
+    std::cout << "Stopped after the traced window, at tick " << std::dec << trace_to << " of " << simlen << "." << std::endl;
+    std::cout << "Partial output signature of ticks [0, " << trace_to << "): " << cumulated_output << "." << std::endl;
+    std::cout << "Partial output digest of ticks [0, " << trace_to << "): 0x" << std::hex << output_digest << "." << std::endl;
+  } else {
+    std::cout << "Output signature: " << std::dec << cumulated_output << "." << std::endl;
+    std::cout << "Output digest: 0x" << std::hex << output_digest << "." << std::endl;
+  }
   std::cout << "Elapsed time: " << std::dec << duration << "." << std::endl;
+  if (sim_thread_times.size() > 1)
+    thread_cpu_times_print(std::cout, sim_thread_times);
+  if (memo_entries > 0)
+    memo_stats_print(std::cout, memo_stats, memo_verify);
 
-  delete my_module;
+  if (toggle_coverage != NULL) {
+    std::cout << "Toggle coverage: " << std::dec << coverage_count(*toggle_coverage) << " of " << 2 * 8 * toggle_coverage->num_state_bytes << " toggles." << std::endl;
+    if (coverage_filepath != NULL && !coverage_write_file(*toggle_coverage, coverage_filepath))
+      exit(1);
+    if (afl_shm_id >= 0 && !coverage_export_afl(*toggle_coverage, afl_shm_id, afl_map_size))
+      exit(1);
+    delete toggle_coverage;
+  }
+  if (tick_stats != NULL) {
+    if (!tick_stats_export(*tick_stats, stats_filepath, cycles_per_ns, simlen, num_threads, duration_ns))
+      exit(1);
+    delete tick_stats;
+  }
+  if (digest_log_fd >= 0)
+    close(digest_log_fd);
+  if (probe_fd >= 0)
+    close(probe_fd);
+  stimulus_close(&random_inputs_from_file);
+  if (memo_stats.verify_mismatches > 0) {
+    std::cerr << "The memoized outputs of " << std::dec << memo_stats.verify_mismatches << " ticks differ from the model." << std::endl;
+    exit(1);
+  }
   exit(0);
 }
@@ -0,0 +1,111 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Co-simulation comparator: replays on the verilated top the input vectors that the Icarus run of
+// tb_icarus.sv streams through the cosim_vpi module, and checks its outputs tick by tick while both run.
+
+#include "Vtop.h"
+#include "verilated.h"
+#include "ticks.h"
+#include "digest.h"
+#include "harness.h"
+#include "cosim_ring.h"
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <chrono>
+
+// This is a generated header
+#include "interface_sizes.h"
+
+typedef Vtop Module;
+typedef Harness<Module, IN_DATA_WIDTH, OUT_DATA_WIDTH, FULL_RANDOM> TbHarness;
+
+void report_divergence(uint64_t tick_id, const uint32_t *in_words, const uint32_t *icarus_out_words, const uint32_t *out_words) {
+  std::cout << "Divergence at tick " << std::dec << tick_id << " between Icarus and Verilator." << std::endl;
+  for (int i = 0; i < TbHarness::kNumInWords; i++)
+    std::cout << "  in_data[" << std::dec << i << "]: 0x" << std::hex << std::setw(8) << std::setfill('0') << in_words[i] << std::endl;
+  for (int i = 0; i < TbHarness::kNumOutWords; i++) {
+    if (icarus_out_words[i] == out_words[i])
+      continue;
+    std::cout << "  out_data[" << std::dec << i << "]: 0x" << std::hex << std::setw(8) << std::setfill('0') << icarus_out_words[i]
+              << " vs 0x" << std::setw(8) << out_words[i] << std::endl;
+  }
+}
+
+/**
+ * Checks the ticks published in the ring until the Icarus side is done.
+ *
+ * @return the first diverging tick, or -1 if all the ticks agree
+ */
+int64_t run_cosim(Module *my_module, CosimRing *ring, uint64_t *num_ticks, uint64_t *cumulated_output, DigestWriter &digests) {
+  uint32_t out_words[TbHarness::kNumOutWords];
+  uint64_t tick_id = 0;
+  while (const uint32_t *slot = cosim_ring_consumer_slot(ring)) {
+    const uint32_t *icarus_out_words = slot + TbHarness::kNumInWords;
+    TbHarness::set_inputs(my_module, slot);
+    my_module->eval();
+    *cumulated_output += TbHarness::accumulate_outputs(my_module, digests);
+    TbHarness::get_outputs(my_module, out_words);
+    if (memcmp(out_words, icarus_out_words, sizeof(out_words))) {
+      report_divergence(tick_id, slot, icarus_out_words, out_words);
+      cosim_ring_consumer_abort(ring);
+      return tick_id;
+    }
+    cosim_ring_consumer_release(ring);
+    tick_id++;
+  }
+  *num_ticks = tick_id;
+  return -1;
+}
+
+int main(int argc, char **argv, char **env) {
+
+  ////////
+  // Create the ring first, the Icarus side waits for it.
+  ////////
+
+  const char *ring_name = cl_get_cosim_ring();
+  CosimRing ring;
+  if (!cosim_ring_create(&ring, ring_name, TbHarness::kNumInWords, TbHarness::kNumOutWords, COSIM_RING_DEFAULT_SLOTS))
+    exit(1);
+  std::cout << "Waiting for ticks on " << ring_name << "." << std::endl;
+
+  ////////
+  // Instantiate the module.
+  ////////
+
+  VerilatedContext *contextp = new VerilatedContext;
+  contextp->commandArgs(argc, argv);
+  Module *my_module = new Module(contextp);
+
+  ////////
+  // Run the experiment.
+  ////////
+
+  uint64_t num_ticks = 0;
+  uint64_t cumulated_output = 0;
+  DigestWriter digests(-1, 0, DIGEST_SEED);
+  auto start = std::chrono::steady_clock::now();
+  int64_t divergent_tick = run_cosim(my_module, &ring, &num_ticks, &cumulated_output, digests);
+  auto stop = std::chrono::steady_clock::now();
+  long duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+
+  bool producer_lost = ring.producer_lost;
+  if (producer_lost) {
+    std::cerr << "The Icarus side " << (ring.header->producer_pid ? "exited without finishing" : "never attached") << ", after "
+              << std::dec << num_ticks << " ticks." << std::endl;
+  } else if (divergent_tick < 0) {
+    std::cout << "Cosimulation complete! " << std::dec << num_ticks << " ticks agree." << std::endl;
+    std::cout << "Output signature: " << std::dec << cumulated_output << "." << std::endl;
+    std::cout << "Output digest: 0x" << std::hex << digests.chain << "." << std::endl;
+  }
+  std::cout << "Elapsed time: " << std::dec << duration << "." << std::endl;
+
+  delete my_module;
+  delete contextp;
+  cosim_ring_close(&ring, ring_name);
+  exit(divergent_tick < 0 && !producer_lost ? 0 : 1);
+}
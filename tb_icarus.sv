@@ -1,6 +1,12 @@
+// With COSIM, the stimulus comes from the cosim_vpi module, which also streams every tick to tb_cosim.
+`ifndef COSIM
 `define DO_TRACE
+`endif
 
+// cosim.sh passes the SIMLEN of the run with -DSIMLEN.
+`ifndef SIMLEN
 `define SIMLEN 10
+`endif
 
 module testbench;
 
@@ -9,9 +15,25 @@ module testbench;
 
   int fd;
   int in_buf;
+`ifdef COSIM
+  bit [288-1:0] cosim_in_data;
+`endif
 
   bit [63:0] cumulated_output;
 
+  // Per-tick output digests, in the same format as the text logs accepted by compare_digests.py.
+  int digest_fd;
+  bit [31:0] tick_digest;
+  bit [31:0] output_digest;
+
+  // Raw CRC32C (reflected polynomial 0x82F63B78) of one word, as in digest.h.
+  function automatic bit [31:0] crc32c_word(input bit [31:0] crc, input bit [31:0] word);
+    crc = crc ^ word;
+    for (int bit_id = 0; bit_id < 32; bit_id++)
+      crc = crc[0] ? (crc >> 1) ^ 32'h82F63B78 : crc >> 1;
+    return crc;
+  endfunction
+
   // Instantiate the design under test (DUT)
   bit [288-1:0]  in_data;
   bit [160-1:0] out_data;
@@ -30,12 +52,18 @@ module testbench;
   // Stimulus generation
   initial begin
     cumulated_output = 0;
+    output_digest = 32'hFFFFFFFF;
+    digest_fd = $fopen("icarus_digests.txt", "w");
 
+`ifdef COSIM
+    $cosim_open(`SIMLEN);
+`else
     fd = $fopen("inputs.txt", "r");
     if (fd == 0) begin
       $display("Error: could not open file `random_inputs.txt`.");
       $finish;
     end
+`endif
 
 `ifdef DO_TRACE
     $dumpfile("icarus_dump.vcd");
@@ -43,20 +71,38 @@ module testbench;
 `endif
 
     for (int step_id = 0; step_id < `SIMLEN; step_id++) begin
+`ifdef COSIM
+      $cosim_get_inputs(cosim_in_data);
+      for (int word_id = 0; word_id < 288 / 32; word_id++) begin
+        in_data_words[word_id] = cosim_in_data[32*word_id +: 32];
+      end
+      #1;
+      $cosim_put_outputs(in_data, out_data);
+`else
       $fscanf(fd, "%d", in_buf);
       in_data_words[0] = in_buf;
       for (int word_id = 1; word_id < 288 / 32; word_id++) begin
         in_data_words[word_id] = in_data_words[0] + word_id;
       end
       #1;
+`endif
 
       // Cumulate the outputs
+      tick_digest = 32'hFFFFFFFF;
       for (int word_id = 0; word_id < 160 / 32; word_id++) begin
         cumulated_output += out_data_words[word_id];
+        tick_digest = crc32c_word(tick_digest, out_data_words[word_id]);
       end
+      output_digest = crc32c_word(output_digest, tick_digest);
+      $fdisplay(digest_fd, "%08x", tick_digest);
     end
 
+    $fclose(digest_fd);
+`ifdef COSIM
+    $cosim_close;
+`endif
     $display("Output signature: %d.", cumulated_output);
+    $display("Output digest: 0x%0x.", output_digest);
   end
 
 endmodule
@@ -0,0 +1,365 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+// Runs several variants of top, verilated with different optimization flags and prefixes,
+// in lockstep on the same input vectors and stops at the first tick where their outputs diverge.
+// With MINIMIZE, then shrinks the diverging stimulus by delta debugging and writes the reproducer.
+
+#include "verilated.h"
+#include "ticks.h"
+#include "stimulus.h"
+#include "harness.h"
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <chrono>
+#include <cassert>
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// This is a generated header
+#include "interface_sizes.h"
+
+// Generated by test_optimizations_lockstep.py. Includes the variant headers and defines
+// LOCKSTEP_VARIANTS(X), which calls X(<model class>, "<optimization flags>") once per variant.
+#include "lockstep_variants.h"
+
+#define NUM_IN_WORDS (Port<IN_DATA_WIDTH>::kNumWords)
+#define NUM_OUT_WORDS (Port<OUT_DATA_WIDTH>::kNumWords)
+#define NUM_RANDOM_INPUTS_PER_TICK (FULL_RANDOM ? NUM_IN_WORDS : 1)
+
+Stimulus random_inputs_from_file;
+
+/* type-erased handle on one verilated variant */
+struct Variant {
+  const char *model_name;
+  const char *flags;
+  void *model;
+  void (*eval)(void *model);
+  void (*destroy)(void *model);
+  void (*set_inputs)(void *model, const uint32_t *in_words);
+  void (*get_outputs)(const void *model, uint32_t *out_words);
+  // Outputs of the last evaluated tick.
+  uint32_t out_data[NUM_OUT_WORDS];
+  uint64_t cumulated_output;
+};
+
+template <typename ModelT>
+Variant make_variant(VerilatedContext *contextp, const char *model_name, const char *flags) {
+  ModelT *model = new ModelT(contextp, model_name);
+  Variant variant;
+  variant.model_name = model_name;
+  variant.flags = flags;
+  variant.model = model;
+  variant.eval = [](void *model) { static_cast<ModelT *>(model)->eval(); };
+  variant.destroy = [](void *model) { delete static_cast<ModelT *>(model); };
+  typedef Harness<ModelT, IN_DATA_WIDTH, OUT_DATA_WIDTH, FULL_RANDOM> VariantHarness;
+  variant.set_inputs = [](void *model, const uint32_t *in_words) { VariantHarness::set_inputs(static_cast<ModelT *>(model), in_words); };
+  variant.get_outputs = [](const void *model, uint32_t *out_words) { VariantHarness::get_outputs(static_cast<const ModelT *>(model), out_words); };
+  variant.cumulated_output = 0;
+  return variant;
+}
+
+void make_variants(VerilatedContext *contextp, std::vector<Variant> &variants) {
+#define MAKE_VARIANT(model_class, flags) variants.push_back(make_variant<model_class>(contextp, #model_class, flags));
+  LOCKSTEP_VARIANTS(MAKE_VARIANT)
+#undef MAKE_VARIANT
+  assert(!variants.empty());
+}
+
+void read_random_inputs_from_file(int simlen) {
+  const char *stimulus_path = cl_get_stimfile();
+  uint64_t seed;
+  bool loaded;
+  if (cl_get_stim_seed(&seed))
+    loaded = stimulus_init_generator(&random_inputs_from_file, cl_get_stim_mode(FULL_RANDOM), seed, cl_get_stim_flips(), NUM_RANDOM_INPUTS_PER_TICK, simlen);
+  else if (stimulus_path == NULL)
+    loaded = stimulus_load_text(&random_inputs_from_file, PATH_TO_RANDOM_INPUTS_FILE, (size_t) simlen * NUM_RANDOM_INPUTS_PER_TICK);
+  else
+    loaded = stimulus_open_binary(&random_inputs_from_file, stimulus_path, cl_get_stim_streaming(), IN_DATA_WIDTH, NUM_RANDOM_INPUTS_PER_TICK, simlen);
+  if (!loaded)
+    exit(1);
+}
+
+void report_divergence(int tick_id, const uint32_t *in_words, const Variant &reference, const Variant &diverging) {
+  std::cout << "Divergence at tick " << std::dec << tick_id << " between " << reference.model_name << " (" << reference.flags
+            << ") and " << diverging.model_name << " (" << diverging.flags << ")." << std::endl;
+  for (int i = 0; i < NUM_IN_WORDS; i++)
+    std::cout << "  in_data[" << std::dec << i << "]: 0x" << std::hex << std::setw(8) << std::setfill('0') << in_words[i] << std::endl;
+  for (int i = 0; i < NUM_OUT_WORDS; i++) {
+    if (reference.out_data[i] == diverging.out_data[i])
+      continue;
+    std::cout << "  out_data[" << std::dec << i << "]: 0x" << std::hex << std::setw(8) << std::setfill('0') << reference.out_data[i]
+              << " vs 0x" << std::setw(8) << diverging.out_data[i] << std::endl;
+  }
+}
+
+/**
+ * Evaluates all the variants on one input vector.
+ *
+ * @return whether any variant diverges from the first one, the reference
+ */
+bool lockstep_tick(std::vector<Variant> &variants, const uint32_t *in_words) {
+  for (Variant &variant : variants) {
+    variant.set_inputs(variant.model, in_words);
+    variant.eval(variant.model);
+    variant.get_outputs(variant.model, variant.out_data);
+    for (int i = 0; i < NUM_OUT_WORDS; i++)
+      variant.cumulated_output += variant.out_data[i];
+  }
+  for (size_t variant_id = 1; variant_id < variants.size(); variant_id++) {
+    if (memcmp(variants[variant_id].out_data, variants[0].out_data, sizeof(variants[0].out_data)))
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Runs all the variants in lockstep. The first variant is the reference.
+ *
+ * @return the first diverging tick, or -1 if all the variants agree on all the ticks
+ */
+int run_lockstep(std::vector<Variant> &variants, int simlen) {
+  StimulusCursor curr_id_in_random_inputs_from_file(&random_inputs_from_file, 0);
+  uint32_t in_words[NUM_IN_WORDS];
+  const Variant &reference = variants[0];
+
+  for (int tick_id = 0; tick_id < simlen; tick_id++) {
+    // Generate the input vector once for all the variants.
+    stimulus_next_input_vector(curr_id_in_random_inputs_from_file, in_words, NUM_IN_WORDS, FULL_RANDOM);
+    if (lockstep_tick(variants, in_words)) {
+      for (size_t variant_id = 1; variant_id < variants.size(); variant_id++) {
+        if (memcmp(variants[variant_id].out_data, reference.out_data, sizeof(reference.out_data)))
+          report_divergence(tick_id, in_words, reference, variants[variant_id]);
+      }
+      return tick_id;
+    }
+  }
+  return -1;
+}
+
+////////
+// Stimulus minimization.
+////////
+
+/*
+ * A candidate stimulus is a sequence of ticks of NUM_RANDOM_INPUTS_PER_TICK words each, in the layout of the
+ * stimulus files. Minimization first drops ticks, then clears set bits, keeping a candidate as long as some
+ * variant still diverges from the reference on it. Each pass is ddmin, with the candidates of every round
+ * tested in parallel by workers that each own a set of variants, constructed once.
+ */
+
+/* one minimization worker and its variants */
+struct MinimizeWorker {
+  VerilatedContext context;
+  std::vector<Variant> variants;
+};
+
+/*
+ * Runs a candidate stimulus; returns whether any variant diverges.
+ * top is combinational, so the variants carry no state from the previous candidate, and a candidate runs exactly
+ * the ticks of the reproducer it would be written as.
+ */
+bool stimulus_diverges(std::vector<Variant> &variants, const std::vector<uint32_t> &words) {
+  Stimulus candidate;
+  candidate.words = words.data();
+  candidate.num_words = words.size();
+  StimulusCursor cursor(&candidate, 0);
+  uint32_t in_words[NUM_IN_WORDS];
+  for (size_t tick_id = 0; tick_id < words.size() / NUM_RANDOM_INPUTS_PER_TICK; tick_id++) {
+    stimulus_next_input_vector(cursor, in_words, NUM_IN_WORDS, FULL_RANDOM);
+    if (lockstep_tick(variants, in_words))
+      return true;
+  }
+  return false;
+}
+
+typedef std::function<std::vector<uint32_t>(const std::vector<int> &kept_elements)> CandidateBuilder;
+
+/* tests the candidates in parallel; returns the index of the first diverging one, or -1 */
+int first_diverging_candidate(std::vector<MinimizeWorker *> &workers, const std::vector<std::vector<int>> &candidates, const CandidateBuilder &build_candidate) {
+  std::atomic<int> next_candidate_id(0);
+  std::atomic<int> first_diverging_id(INT_MAX);
+  std::vector<std::thread> threads;
+  for (MinimizeWorker *worker : workers) {
+    threads.emplace_back([&, worker]() {
+      int candidate_id;
+      // Candidates after an already diverging one cannot win, so they are skipped.
+      while ((candidate_id = next_candidate_id++) < (int) candidates.size() && candidate_id < first_diverging_id) {
+        if (!stimulus_diverges(worker->variants, build_candidate(candidates[candidate_id])))
+          continue;
+        int known_id = first_diverging_id;
+        while (candidate_id < known_id && !first_diverging_id.compare_exchange_weak(known_id, candidate_id));
+      }
+    });
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+  return first_diverging_id == INT_MAX ? -1 : (int) first_diverging_id;
+}
+
+/* ddmin over the elements [0, num_elements), which together diverge; returns a 1-minimal diverging subset */
+std::vector<int> ddmin(std::vector<MinimizeWorker *> &workers, int num_elements, const CandidateBuilder &build_candidate) {
+  std::vector<int> current(num_elements);
+  for (int i = 0; i < num_elements; i++)
+    current[i] = i;
+  size_t granularity = 2;
+  while (current.size() >= 2) {
+    granularity = std::min(granularity, current.size());
+    // The chunks first, then their complements, which are redundant with the chunks for a granularity of 2.
+    std::vector<std::vector<int>> candidates(granularity);
+    for (size_t i = 0; i < current.size(); i++)
+      candidates[i * granularity / current.size()].push_back(current[i]);
+    for (size_t chunk_id = 0; chunk_id < granularity && granularity > 2; chunk_id++) {
+      std::vector<int> complement;
+      for (size_t other_chunk_id = 0; other_chunk_id < granularity; other_chunk_id++) {
+        if (other_chunk_id != chunk_id)
+          complement.insert(complement.end(), candidates[other_chunk_id].begin(), candidates[other_chunk_id].end());
+      }
+      candidates.push_back(complement);
+    }
+
+    int diverging_id = first_diverging_candidate(workers, candidates, build_candidate);
+    if (diverging_id >= 0 && diverging_id < (int) granularity) {
+      current = candidates[diverging_id];
+      granularity = 2;
+    } else if (diverging_id >= 0) {
+      current = candidates[diverging_id];
+      granularity = std::max(granularity - 1, (size_t) 2);
+    } else if (granularity == current.size()) {
+      break;
+    } else {
+      granularity = std::min(2 * granularity, current.size());
+    }
+  }
+  return current;
+}
+
+/**
+ * Minimizes a diverging stimulus and writes it as a binary stimulus file.
+ *
+ * @param divergent_tick the first diverging tick of the stimulus, after which ticks are ignored
+ */
+void minimize_stimulus(int divergent_tick, const char *minimize_path, int num_threads) {
+  // Recover the stimulus words of the ticks up to the divergence, whatever their source.
+  int num_ticks = divergent_tick + 1;
+  std::vector<uint32_t> words;
+  StimulusCursor cursor(&random_inputs_from_file, 0);
+  uint32_t in_words[NUM_IN_WORDS];
+  for (int tick_id = 0; tick_id < num_ticks; tick_id++) {
+    stimulus_next_input_vector(cursor, in_words, NUM_IN_WORDS, FULL_RANDOM);
+    for (int i = 0; i < NUM_IN_WORDS && !FULL_RANDOM; i++) {
+      if (in_words[i] != in_words[0] + i) { std::cerr << "Only replicated input vectors can be minimized without FULL_RANDOM." << std::endl; exit(1); }
+    }
+    words.insert(words.end(), in_words, in_words + NUM_RANDOM_INPUTS_PER_TICK);
+  }
+
+  std::vector<MinimizeWorker *> workers;
+  for (int worker_id = 0; worker_id < num_threads; worker_id++) {
+    workers.push_back(new MinimizeWorker);
+    make_variants(&workers.back()->context, workers.back()->variants);
+  }
+  std::cout << "Minimizing " << std::dec << num_ticks << " ticks on " << num_threads << " threads." << std::endl;
+
+  std::vector<int> kept_ticks = ddmin(workers, num_ticks, [&words](const std::vector<int> &kept_ticks) {
+    std::vector<uint32_t> candidate;
+    for (int tick_id : kept_ticks)
+      candidate.insert(candidate.end(), words.begin() + tick_id * NUM_RANDOM_INPUTS_PER_TICK, words.begin() + (tick_id + 1) * NUM_RANDOM_INPUTS_PER_TICK);
+    return candidate;
+  });
+  std::vector<uint32_t> tick_words;
+  for (int tick_id : kept_ticks)
+    tick_words.insert(tick_words.end(), words.begin() + tick_id * NUM_RANDOM_INPUTS_PER_TICK, words.begin() + (tick_id + 1) * NUM_RANDOM_INPUTS_PER_TICK);
+  std::cout << "Kept " << kept_ticks.size() << " ticks." << std::endl;
+
+  std::vector<int> set_bits;
+  for (size_t bit_id = 0; bit_id < 32 * tick_words.size(); bit_id++) {
+    if ((tick_words[bit_id / 32] >> (bit_id % 32)) & 1)
+      set_bits.push_back(bit_id);
+  }
+  std::vector<uint32_t> minimized_words(tick_words.size(), 0);
+  auto build_bits_candidate = [&tick_words, &set_bits](const std::vector<int> &kept_bits) {
+    std::vector<uint32_t> candidate(tick_words.size(), 0);
+    for (int set_bit_id : kept_bits)
+      candidate[set_bits[set_bit_id] / 32] |= 1u << (set_bits[set_bit_id] % 32);
+    return candidate;
+  };
+  // All-zero words may already diverge, and ddmin needs a non-empty diverging set otherwise.
+  if (!stimulus_diverges(workers[0]->variants, minimized_words) && !set_bits.empty())
+    minimized_words = build_bits_candidate(ddmin(workers, set_bits.size(), build_bits_candidate));
+
+  int num_set_bits = 0;
+  for (uint32_t word : minimized_words)
+    num_set_bits += __builtin_popcount(word);
+  std::cout << "Kept " << num_set_bits << " of " << set_bits.size() << " set bits." << std::endl;
+  for (size_t tick_id = 0; tick_id < kept_ticks.size(); tick_id++) {
+    std::cout << "  tick " << std::dec << tick_id << " (was " << kept_ticks[tick_id] << "):";
+    for (int i = 0; i < NUM_RANDOM_INPUTS_PER_TICK; i++)
+      std::cout << " 0x" << std::hex << std::setw(8) << std::setfill('0') << minimized_words[tick_id * NUM_RANDOM_INPUTS_PER_TICK + i];
+    std::cout << std::endl;
+  }
+
+  for (MinimizeWorker *worker : workers) {
+    for (Variant &variant : worker->variants)
+      variant.destroy(variant.model);
+    delete worker;
+  }
+  if (!stimulus_write_binary(minimize_path, IN_DATA_WIDTH, NUM_RANDOM_INPUTS_PER_TICK, minimized_words.data(), kept_ticks.size()))
+    exit(1);
+  std::cout << "Reproduce with STIMFILE=" << minimize_path << " SIMLEN=" << std::dec << kept_ticks.size() << "." << std::endl;
+}
+
+int main(int argc, char **argv, char **env) {
+
+  Verilated::commandArgs(argc, argv);
+
+  ////////
+  // Get the env vars early to avoid Verilator segfaults.
+  ////////
+
+  std::cout << "Starting getting env variables." << std::endl;
+  int simlen = get_sim_length_cycles(0);
+  read_random_inputs_from_file(simlen);
+
+  ////////
+  // Instantiate the variants.
+  ////////
+
+  VerilatedContext context;
+  std::vector<Variant> variants;
+  make_variants(&context, variants);
+
+  ////////
+  // Run the experiment.
+  ////////
+
+  auto start = std::chrono::steady_clock::now();
+  int divergent_tick = run_lockstep(variants, simlen);
+  auto stop = std::chrono::steady_clock::now();
+  long duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+
+  if (divergent_tick < 0) {
+    std::cout << "Testbench complete!" << std::endl;
+    for (const Variant &variant : variants)
+      std::cout << "For " << variant.flags << ": Output signature: " << std::dec << variant.cumulated_output << "." << std::endl;
+  }
+  std::cout << "Elapsed time: " << std::dec << duration << "." << std::endl;
+
+  for (Variant &variant : variants)
+    variant.destroy(variant.model);
+
+  ////////
+  // Minimize the diverging stimulus.
+  ////////
+
+  const char *minimize_path = cl_get_minimize_file();
+  if (divergent_tick >= 0 && minimize_path != NULL)
+    minimize_stimulus(divergent_tick, minimize_path, cl_get_minimize_threads());
+  stimulus_close(&random_inputs_from_file);
+  exit(divergent_tick < 0 ? 0 : 1);
+}
@@ -1,6 +1,11 @@
+import argparse
+import functools
+import os
 import subprocess
 import multiprocessing as mp
 
+import build_cache
+
 optimization_exclusions = [
     '-fno-acyc-simp',
     '-fno-assemble',
@@ -34,14 +39,24 @@ optimization_exclusions = [
 # We also add a compound of all no-optimizations
 optimization_exclusions.append(' '.join(optimization_exclusions))
 
+# Flags of every variant besides its optimization flags, shared with test_optimizations_lockstep.py so that both
+# scripts check the same models: this is the flag matrix that produced the divergence shown in the README.
+VERILATOR_WARNING_FLAGS = "--Wno-UNOPTFLAT --Wno-WIDTHTRUNC --Wno-CMPCONST -Wno-WIDTHEXPAND"
+VARIANT_FLAGS = "--debug --trace"
+VARIANT_CFLAGS = "-g"
+
 # Now, we try with all the no-optimizations
-def worker(no_optim_flag_id: str):
+def worker(use_build_cache: bool, no_optim_flag_id: str):
     print(f"Running {no_optim_flag_id}")
     obj_dir_name = f"obj_dir_{no_optim_flag_id}"
     no_optim_flag = optimization_exclusions[no_optim_flag_id]
-    verilate_cmd_str = f"verilator --cc --debug {no_optim_flag} --exe --Wno-UNOPTFLAT --Wno-WIDTHTRUNC --Wno-CMPCONST -Wno-WIDTHEXPAND --build tb_base.cc top.sv -CFLAGS '-g' --Mdir {obj_dir_name} --trace --build-jobs 16"
     try:
-        subprocess.run(verilate_cmd_str, shell=True, check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        if use_build_cache:
+            num_hits, num_misses = build_cache.build_model(os.path.abspath(obj_dir_name), f"{VARIANT_FLAGS} {no_optim_flag}", cflags=VARIANT_CFLAGS, build_jobs=16)
+            print(f"Built {no_optim_flag}: {num_hits} cached and {num_misses} compiled translation units.")
+        else:
+            verilate_cmd_str = f"verilator --cc {VARIANT_FLAGS} {no_optim_flag} --exe {VERILATOR_WARNING_FLAGS} --build tb_base.cc top.sv -CFLAGS '{VARIANT_CFLAGS}' --Mdir {obj_dir_name} --build-jobs 16"
+            subprocess.run(verilate_cmd_str, shell=True, check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
     except:
         print(f"Failed verilation with {no_optim_flag}")
         return None
@@ -56,13 +71,18 @@ def worker(no_optim_flag_id: str):
     print(f"Finished {no_optim_flag}: {ret_lines}")
     return ret_lines
 
-with mp.Pool(mp.cpu_count()) as pool:
-    results = pool.map(worker, range(len(optimization_exclusions)))
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--build-cache', action='store_true', help='Reuse the objects of the runtime and of the translation units that a flag does not change across the variants.')
+    args = parser.parse_args()
+
+    with mp.Pool(mp.cpu_count()) as pool:
+        results = pool.map(functools.partial(worker, args.build_cache), range(len(optimization_exclusions)))
 
-for result_id, result in enumerate(results):
-    if result is None:
-        print(f"Failed to run {optimization_exclusions[result_id]}")
-    for line in result:
-        if 'Output signature' in line:
-            print(f"For {optimization_exclusions[result_id]}: {line}")
-            break
+    for result_id, result in enumerate(results):
+        if result is None:
+            print(f"Failed to run {optimization_exclusions[result_id]}")
+        for line in result:
+            if 'Output signature' in line:
+                print(f"For {optimization_exclusions[result_id]}: {line}")
+                break
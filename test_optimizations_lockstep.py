@@ -0,0 +1,67 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Builds a single tb_lockstep.cc binary that links one model per optimization flag set of test_optimizations.py,
+# each verilated with its own prefix, and runs all of them in lockstep on the same input vectors.
+# The first variant, with all the optimizations enabled, is the reference.
+# The variants are verilated with the same flags as in test_optimizations.py, so that both scripts check the same models.
+
+import multiprocessing as mp
+import os
+import subprocess
+import sys
+
+from test_optimizations import optimization_exclusions, VERILATOR_WARNING_FLAGS, VARIANT_FLAGS, VARIANT_CFLAGS
+
+BUILD_DIR = os.path.abspath('obj_dir_lockstep')
+REPO_DIR = os.path.dirname(os.path.abspath(__file__))
+VERILATOR_FLAGS = f"--cc {VARIANT_FLAGS} {VERILATOR_WARNING_FLAGS}"
+
+variants = [''] + optimization_exclusions
+
+def variant_prefix(variant_id: int):
+    return f"Vtop{variant_id}"
+
+def variant_dir(variant_id: int):
+    return os.path.join(BUILD_DIR, variant_prefix(variant_id))
+
+# Builds the model archive of one variant. The reference variant is built together with the harness instead.
+def build_variant(variant_id: int):
+    verilate_cmd_str = f"verilator {VERILATOR_FLAGS} {variants[variant_id]} --prefix {variant_prefix(variant_id)} --build top.sv -CFLAGS '{VARIANT_CFLAGS}' --Mdir {variant_dir(variant_id)} --build-jobs 4"
+    try:
+        subprocess.run(verilate_cmd_str, shell=True, check=True, cwd=REPO_DIR, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    except:
+        print(f"Failed verilation with {variants[variant_id]}")
+        return False
+    return True
+
+def write_variants_header():
+    with open(os.path.join(BUILD_DIR, 'lockstep_variants.h'), 'w') as f:
+        f.write("// Generated by test_optimizations_lockstep.py.\n#pragma once\n")
+        for variant_id in range(len(variants)):
+            f.write(f"#include \"{variant_prefix(variant_id)}.h\"\n")
+        f.write("#define LOCKSTEP_VARIANTS(X) \\\n")
+        for variant_id, flags in enumerate(variants):
+            f.write(f"  X({variant_prefix(variant_id)}, \"{flags if flags else 'reference'}\") \\\n")
+        f.write("\n")
+
+if __name__ == '__main__':
+    os.makedirs(BUILD_DIR, exist_ok=True)
+    with mp.Pool(mp.cpu_count()) as pool:
+        built = pool.map(build_variant, range(1, len(variants)))
+    if not all(built):
+        sys.exit(1)
+    write_variants_header()
+
+    include_flags = ' '.join(f"-I{variant_dir(variant_id)}" for variant_id in range(len(variants))) + f" -I{BUILD_DIR}"
+    archives = ' '.join(os.path.join(variant_dir(variant_id), f"{variant_prefix(variant_id)}__ALL.a") for variant_id in range(1, len(variants)))
+    verilate_cmd_str = f"verilator {VERILATOR_FLAGS} --prefix {variant_prefix(0)} --exe --build tb_lockstep.cc top.sv {archives} -CFLAGS '{VARIANT_CFLAGS} {include_flags}' --Mdir {variant_dir(0)} -o Vlockstep --build-jobs 16"
+    subprocess.run(verilate_cmd_str, shell=True, check=True, cwd=REPO_DIR, stdout=subprocess.DEVNULL)
+
+    # The run takes SIMLEN, MINIMIZE and the stimulus settings from the environment of the caller.
+    # SIMLEN defaults to the length of the runs of test_optimizations.py.
+    run_env = dict(os.environ)
+    run_env.setdefault('SIMLEN', '10')
+    subprocess_result = subprocess.run(os.path.join(variant_dir(0), 'Vlockstep'), cwd=REPO_DIR, env=run_env)
+    sys.exit(subprocess_result.returncode)
@@ -0,0 +1,55 @@
+# Copyright 2023 Flavien Solt, ETH Zurich.
+# Licensed under the General Public License, Version 3.0, see LICENSE for details.
+# SPDX-License-Identifier: GPL-3.0-only
+
+# Generates probe_table.h and coverage_signals.h, builds the harness against them with --public-flat-rw,
+# runs it with PROBES and COVERAGE_FILE, and decodes the probe file with decode_probes.py.
+# The generated headers are removed afterwards, so that the other builds of top.sv are left unchanged.
+
+import os
+import subprocess
+import sys
+
+import decode_probes
+
+REPO_DIR = os.path.dirname(os.path.abspath(__file__))
+BUILD_DIR = os.path.join(REPO_DIR, 'obj_dir_signals')
+GENERATED_HEADERS = [os.path.join(REPO_DIR, 'probe_table.h'), os.path.join(REPO_DIR, 'coverage_signals.h')]
+VERILATOR_FLAGS = "--cc --exe --public-flat-rw --Wno-UNOPTFLAT --Wno-WIDTHTRUNC --Wno-CMPCONST -Wno-WIDTHEXPAND"
+
+SIMLEN = 10
+PROBES = 'signal00[0-3]_,signal072_'
+
+def run(cmd_str: str, env=None):
+    return subprocess.run(cmd_str, shell=True, check=True, cwd=REPO_DIR, env=env, stdout=subprocess.PIPE).stdout.decode('utf-8')
+
+def check(condition: bool, message: str):
+    if not condition:
+        print(f"Failed: {message}")
+        sys.exit(1)
+
+if __name__ == '__main__':
+    try:
+        run("python3 gen_probe_table.py top.sv probe_table.h")
+        run("python3 gen_coverage_signals.py top.sv coverage_signals.h --signals 'signal0*'")
+        run(f"verilator {VERILATOR_FLAGS} --build tb_base.cc top.sv -CFLAGS '-g' --Mdir {BUILD_DIR} --build-jobs 16")
+    finally:
+        for header_path in GENERATED_HEADERS:
+            if os.path.exists(header_path):
+                os.remove(header_path)
+
+    probe_path = os.path.join(BUILD_DIR, 'probes.bin')
+    env = dict(os.environ, SIMLEN=str(SIMLEN), PROBES=PROBES, PROBEFILE=probe_path, COVERAGE_FILE=os.path.join(BUILD_DIR, 'coverage.bin'))
+    output = run(os.path.join(BUILD_DIR, 'Vtop'), env)
+    check('Output signature' in output, "the harness did not complete.")
+    check('Toggle coverage' in output, "no toggle coverage was reported.")
+
+    first_tick, signals, ticks = decode_probes.read_probes(probe_path)
+    check(first_tick == 0 and len(ticks) == SIMLEN, f"expected {SIMLEN} ticks from tick 0, got {len(ticks)} from tick {first_tick}.")
+    check([name for name, _ in signals] == ['signal000_', 'signal001_', 'signal002_', 'signal003_', 'signal072_'], f"unexpected probed signals {signals}.")
+    check(all(value < (1 << width) for values in ticks for value, (_, width) in zip(values, signals)), "a probed value exceeds the width of its signal.")
+    # signal000_ is assigned ~signal001_ in top.sv.
+    check(all(values[0] == 1 - values[1] for values in ticks), "signal000_ is not the complement of signal001_.")
+
+    run(f"python3 decode_probes.py {probe_path} --vcd {os.path.join(BUILD_DIR, 'probes.vcd')}")
+    print(f"Probed {len(signals)} signals over {len(ticks)} ticks.")
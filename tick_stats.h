@@ -0,0 +1,173 @@
+// Copyright 2023 Flavien Solt, ETH Zurich.
+// Licensed under the General Public License, Version 3.0, see LICENSE for details.
+// SPDX-License-Identifier: GPL-3.0-only
+
+/* per-phase tick latency histograms, timed with the TSC where available */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum TickPhase {
+  TICK_PHASE_RANDOMIZE_INPUTS,
+  TICK_PHASE_EVAL,
+  TICK_PHASE_TRACE,
+  TICK_PHASE_ACCUMULATE_OUTPUTS,
+  TICK_PHASE_COVERAGE,
+  TICK_PHASE_PROBES,
+  // Whole tick, including the phases above.
+  TICK_PHASE_TICK,
+  NUM_TICK_PHASES
+};
+
+static const char *tick_phase_names[NUM_TICK_PHASES] = {"randomize_inputs", "eval", "trace", "accumulate_outputs", "coverage", "probes", "tick"};
+
+/*
+ * Latencies are counted in timestamp counter cycles and bucketed logarithmically with 4 buckets per power of two:
+ * values below 4 have their own bucket, and a value v >= 4 with most significant bit m goes to 4 * (m - 1) + (the 2 bits below m).
+ */
+#define TICK_STATS_NUM_BUCKETS 256
+
+struct LatencyHistogram {
+  uint64_t buckets[TICK_STATS_NUM_BUCKETS];
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+};
+
+struct TickStats {
+  LatencyHistogram phases[NUM_TICK_PHASES];
+
+  TickStats() { memset(phases, 0, sizeof(phases)); }
+};
+
+static inline uint64_t tick_stats_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/* timestamp counter cycles per nanosecond, measured against the steady clock */
+static double tick_stats_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  auto clock_start = std::chrono::steady_clock::now();
+  uint64_t tsc_start = __rdtsc();
+  while (std::chrono::steady_clock::now() - clock_start < std::chrono::milliseconds(20));
+  uint64_t tsc_stop = __rdtsc();
+  auto clock_stop = std::chrono::steady_clock::now();
+  return (double) (tsc_stop - tsc_start) / std::chrono::duration_cast<std::chrono::nanoseconds>(clock_stop - clock_start).count();
+#else
+  return 1.0;
+#endif
+}
+
+static inline int latency_bucket(uint64_t value)
+{
+  if (value < 4)
+    return value;
+  int msb = 63 - __builtin_clzll(value);
+  return 4 * (msb - 1) + ((value >> (msb - 2)) & 3);
+}
+
+/* largest value falling into a bucket */
+static uint64_t latency_bucket_upper_bound(int bucket_id)
+{
+  if (bucket_id < 4)
+    return bucket_id;
+  int msb = bucket_id / 4 + 1;
+  uint64_t lower_bound = (uint64_t) (4 + bucket_id % 4) << (msb - 2);
+  return lower_bound + ((uint64_t) 1 << (msb - 2)) - 1;
+}
+
+static inline void latency_record(LatencyHistogram &histogram, uint64_t value)
+{
+  histogram.buckets[latency_bucket(value)]++;
+  histogram.count++;
+  histogram.total += value;
+  if (value > histogram.max)
+    histogram.max = value;
+}
+
+/* records the time elapsed since *lap into the phase, and restarts the lap; a NULL stats disables all timing */
+static inline void tick_stats_lap(TickStats *stats, TickPhase phase, uint64_t *lap)
+{
+  if (stats == NULL)
+    return;
+  uint64_t now = tick_stats_now();
+  latency_record(stats->phases[phase], now - *lap);
+  *lap = now;
+}
+
+static inline uint64_t tick_stats_start(TickStats *stats)
+{
+  return stats == NULL ? 0 : tick_stats_now();
+}
+
+static void tick_stats_merge(TickStats &into, const TickStats &from)
+{
+  for (int phase = 0; phase < NUM_TICK_PHASES; phase++) {
+    for (int bucket_id = 0; bucket_id < TICK_STATS_NUM_BUCKETS; bucket_id++)
+      into.phases[phase].buckets[bucket_id] += from.phases[phase].buckets[bucket_id];
+    into.phases[phase].count += from.phases[phase].count;
+    into.phases[phase].total += from.phases[phase].total;
+    if (from.phases[phase].max > into.phases[phase].max)
+      into.phases[phase].max = from.phases[phase].max;
+  }
+}
+
+static uint64_t latency_percentile(const LatencyHistogram &histogram, double percentile)
+{
+  uint64_t rank = (uint64_t) (percentile * histogram.count);
+  uint64_t seen = 0;
+  for (int bucket_id = 0; bucket_id < TICK_STATS_NUM_BUCKETS; bucket_id++) {
+    seen += histogram.buckets[bucket_id];
+    if (seen > rank)
+      return std::min(latency_bucket_upper_bound(bucket_id), histogram.max);
+  }
+  return histogram.max;
+}
+
+/* writes the stats as CSV if the path ends with .csv, and as JSON otherwise */
+static bool tick_stats_export(const TickStats &stats, const char *path, double cycles_per_ns, int simlen, int num_threads, uint64_t elapsed_ns)
+{
+  FILE *f = fopen(path, "w");
+  if (f == NULL) { std::cerr << "Could not write stats file " << path << "." << std::endl; return false; }
+  std::string path_str(path);
+  bool csv = path_str.size() >= 4 && path_str.compare(path_str.size() - 4, 4, ".csv") == 0;
+
+  if (csv)
+    fprintf(f, "phase,count,total_ns,mean_ns,p50_ns,p99_ns,max_ns\n");
+  else
+    fprintf(f, "{\n  \"simlen\": %d,\n  \"num_threads\": %d,\n  \"elapsed_ns\": %llu,\n  \"cycles_per_ns\": %.4f,\n  \"phases\": {\n",
+            simlen, num_threads, (unsigned long long) elapsed_ns, cycles_per_ns);
+  for (int phase = 0; phase < NUM_TICK_PHASES; phase++) {
+    const LatencyHistogram &histogram = stats.phases[phase];
+    double total_ns = histogram.total / cycles_per_ns;
+    double mean_ns = histogram.count ? total_ns / histogram.count : 0;
+    double p50_ns = latency_percentile(histogram, 0.50) / cycles_per_ns;
+    double p99_ns = latency_percentile(histogram, 0.99) / cycles_per_ns;
+    double max_ns = histogram.max / cycles_per_ns;
+    if (csv)
+      fprintf(f, "%s,%llu,%.0f,%.1f,%.1f,%.1f,%.1f\n", tick_phase_names[phase], (unsigned long long) histogram.count, total_ns, mean_ns, p50_ns, p99_ns, max_ns);
+    else
+      fprintf(f, "    \"%s\": {\"count\": %llu, \"total_ns\": %.0f, \"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, \"max_ns\": %.1f}%s\n",
+              tick_phase_names[phase], (unsigned long long) histogram.count, total_ns, mean_ns, p50_ns, p99_ns, max_ns, phase + 1 < NUM_TICK_PHASES ? "," : "");
+  }
+  if (!csv)
+    fprintf(f, "  }\n}\n");
+  fclose(f);
+  return true;
+}
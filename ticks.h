@@ -7,10 +7,16 @@
 
 /* used by multiple designs */
 #include <chrono>
+#include <cstdint>
 
 #include <iostream>
 #include <cassert>
 #include <sstream>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "affinity.h"
 
 static int get_sim_length_cycles(int lead_time_cycles)
 {
@@ -24,6 +30,175 @@ static int get_sim_length_cycles(int lead_time_cycles)
   return simlen - lead_time_cycles;
 }
 
+static int get_num_sim_threads(int simlen)
+{
+  const char* threads_env = std::getenv("SIMTHREADS");
+  if(threads_env == NULL) return 1;
+  int num_threads = atoi(threads_env);
+  assert(num_threads > 0);
+  // Never spawn more shards than there are ticks.
+  if(num_threads > simlen) num_threads = simlen;
+  std::cout << "SIMTHREADS set to " << num_threads << " threads." << std::endl;
+  return num_threads;
+}
+
+static int cl_get_eval_threads(std::ostream &out)
+{
+  // Threads of the VerilatedContext of each model, for models verilated with --threads. If unset, keep the context default.
+  const char *threads_env = std::getenv("EVAL_THREADS");
+  if(threads_env == NULL) return 0;
+  int num_threads = atoi(threads_env);
+  assert(num_threads > 0);
+  out << "EVAL_THREADS set to " << num_threads << " threads." << std::endl;
+  return num_threads;
+}
+
+static bool cl_get_sim_cpus(std::vector<int> &cpus)
+{
+  // CPUs to pin the simulation threads to, as a CPU list ("0-3,8") in CPUS or as a NUMA node in NUMA_NODE.
+  const char *cpus_env = std::getenv("CPUS");
+  const char *node_env = std::getenv("NUMA_NODE");
+  if(cpus_env != NULL && node_env != NULL) { std::cerr << "CPUS and NUMA_NODE are mutually exclusive." << std::endl; return false; }
+  if(cpus_env != NULL && !cpu_list_parse(cpus_env, cpus)) { std::cerr << "Malformed CPU list " << cpus_env << "." << std::endl; return false; }
+  if(node_env != NULL && !numa_node_cpus(atoi(node_env), cpus)) return false;
+  return true;
+}
+
+static const char *cl_get_stimfile(void)
+{
+  // Binary stimulus file produced by convert_inputs.py. If unset, PATH_TO_RANDOM_INPUTS_FILE is parsed as text.
+  return std::getenv("STIMFILE");
+}
+
+static bool cl_get_stim_seed(uint64_t *seed)
+{
+  // Generate the stimulus in process from SEED instead of reading a stimulus file. Returns false if unset.
+  const char *seed_env = std::getenv("SEED");
+  if(seed_env == NULL) return false;
+  *seed = strtoull(seed_env, NULL, 0);
+  std::cout << "SEED set to " << *seed << "." << std::endl;
+  return true;
+}
+
+static const char *cl_get_stim_mode(bool full_random)
+{
+  // Generator mode: full, replicate or bitflip. Defaults to the mode of the stimulus files of this design.
+  const char *mode_env = std::getenv("STIM_MODE");
+  if(mode_env != NULL) return mode_env;
+  return full_random ? "full" : "replicate";
+}
+
+static int cl_get_stim_flips(void)
+{
+  // Number of bits flipped per tick in bitflip mode.
+  const char *flips_env = std::getenv("STIM_FLIPS");
+  if(flips_env == NULL) return 1;
+  int num_flips = atoi(flips_env);
+  assert(num_flips >= 0);
+  return num_flips;
+}
+
+static bool cl_get_stim_streaming(void)
+{
+  // Read the binary stimulus file in chunks instead of mapping it, for stimuli larger than memory.
+  const char *stream_env = std::getenv("STIMSTREAM");
+  return stream_env != NULL && atoi(stream_env) != 0;
+}
+
+static const char *cl_get_server_socket(void)
+{
+  // Unix socket path to serve jobs on, or "-" for stdin/stdout. If unset, the harness runs a single simulation.
+  return std::getenv("SERVER_SOCKET");
+}
+
+static const char *cl_get_cosim_ring(void)
+{
+  // Name of the POSIX shared-memory ring between tb_cosim and the cosim_vpi module.
+  const char *ring_env = std::getenv("COSIM_RING");
+  return ring_env == NULL ? "/tbcosim" : ring_env;
+}
+
+static const char *cl_get_minimize_file(void)
+{
+  // After a divergence, minimize the stimulus and write the reproducer to this binary stimulus file.
+  return std::getenv("MINIMIZE");
+}
+
+static int cl_get_minimize_threads(void)
+{
+  const char *threads_env = std::getenv("MINIMIZE_THREADS");
+  if(threads_env == NULL) return std::max(1u, std::thread::hardware_concurrency());
+  int num_threads = atoi(threads_env);
+  assert(num_threads > 0);
+  return num_threads;
+}
+
+static const char *cl_get_digestfile(void)
+{
+  // Binary log of the per-tick output digests, compared with compare_digests.py.
+  return std::getenv("DIGESTFILE");
+}
+
+static const char *cl_get_statsfile(void)
+{
+  // Per-phase tick latency statistics, written as CSV if the path ends with .csv and as JSON otherwise.
+  return std::getenv("STATSFILE");
+}
+
+static const char *cl_get_coverage_file(void)
+{
+  // Toggle coverage bitmaps of the outputs and of the signals listed in coverage_signals.h.
+  return std::getenv("COVERAGE_FILE");
+}
+
+static int cl_get_afl_shm_id(void)
+{
+  // Shared-memory map set up by AFL, which then also receives the toggle coverage. Returns -1 if unset.
+  const char *shm_env = std::getenv("__AFL_SHM_ID");
+  return shm_env == NULL ? -1 : atoi(shm_env);
+}
+
+static uint64_t cl_get_afl_map_size(uint64_t default_map_size)
+{
+  // Entries of the AFL map. AFL++ accepts 64 to 2^29 entries and rounds the size up to a multiple of 64, as done here.
+  const char *map_size_env = std::getenv("AFL_MAP_SIZE");
+  if(map_size_env == NULL) return default_map_size;
+  char *map_size_end;
+  unsigned long long map_size = strtoull(map_size_env, &map_size_end, 0);
+  assert(map_size_end != map_size_env && *map_size_end == '\0');
+  assert(map_size >= 64 && map_size <= (1ull << 29));
+  return (map_size + 63) / 64 * 64;
+}
+
+static uint64_t cl_get_memo_entries(void)
+{
+  // Entries of the memoization table of each model, rounded up to a power of two. If unset, every tick is evaluated.
+  const char *entries_env = std::getenv("MEMO_ENTRIES");
+  if(entries_env == NULL) return 0;
+  long long num_entries = atoll(entries_env);
+  assert(num_entries > 0);
+  return num_entries;
+}
+
+static bool cl_get_memo_verify(void)
+{
+  // Also evaluate the ticks found in the memoization table, and count those whose outputs differ.
+  const char *verify_env = std::getenv("MEMO_VERIFY");
+  return verify_env != NULL && atoi(verify_env) != 0;
+}
+
+static const char *cl_get_probes(void)
+{
+  // Comma-separated glob patterns of the signals of probe_table.h to dump every tick. If unset, nothing is probed.
+  return std::getenv("PROBES");
+}
+
+static const char *cl_get_probefile(void)
+{
+  const char *probe_env = std::getenv("PROBEFILE");
+  return probe_env == NULL ? "probes.bin" : probe_env;
+}
+
 static const char *cl_get_tracefile(void)
 {
 #if VM_TRACE
@@ -34,3 +209,37 @@ static const char *cl_get_tracefile(void)
   return "";
 #endif
 }
+
+static bool cl_get_trace_async(void)
+{
+  // Write the trace from a background thread instead of the eval thread.
+  const char *async_env = std::getenv("TRACE_ASYNC");
+  return async_env != NULL && atoi(async_env) != 0;
+}
+
+static int cl_get_checkpoint_every(void)
+{
+  // Save a checkpoint every CHECKPOINT_EVERY ticks. If unset, no checkpoint is saved.
+  const char *every_env = std::getenv("CHECKPOINT_EVERY");
+  if(every_env == NULL) return 0;
+  int checkpoint_every = atoi(every_env);
+  assert(checkpoint_every > 0);
+  return checkpoint_every;
+}
+
+static const char *cl_get_checkpoint_dir(void)
+{
+  const char *dir_env = std::getenv("CHECKPOINT_DIR");
+  return dir_env == NULL ? "checkpoints" : dir_env;
+}
+
+static void cl_get_trace_window(int simlen, int *trace_from, int *trace_to)
+{
+  // Only trace the ticks [TRACE_FROM, TRACE_TO), resuming from the nearest checkpoint in CHECKPOINT_DIR.
+  const char *from_env = std::getenv("TRACE_FROM");
+  const char *to_env = std::getenv("TRACE_TO");
+  *trace_from = from_env == NULL ? 0 : atoi(from_env);
+  *trace_to = to_env == NULL ? -1 : std::min(atoi(to_env), simlen);
+  assert(*trace_from >= 0 && *trace_from < simlen);
+  assert(*trace_to < 0 || *trace_to > *trace_from);
+}